@@ -0,0 +1,345 @@
+/*
+ * baseline.c - Record benchmark results as a baseline and compare runs against it
+ *
+ * Build:
+ *     gcc -O2 -o baseline baseline.c -lm
+ *
+ * Usage:
+ *     baseline record [-m key=value]... out.tsv result.tsv...
+ *         Fold the output of mmbench (plain mode) and microbench runs into a
+ *         baseline file. Rows repeated across results, e.g. from running
+ *         mmbench several times, are merged into their median and median
+ *         absolute deviation; a case that failed in any of them is recorded
+ *         as failed. -m lines end up in the header.
+ *     baseline compare [-t rel] [-u abs] [-k k] base.tsv new.tsv
+ *         Compare two baseline files case by case. A metric regressed when it
+ *         got worse by more than the larger of rel (default 0.05) of the base
+ *         value and k (default 3) times the summed deviations of both files;
+ *         utilization uses abs (default 0.01) in place of rel. A metric that
+ *         failed in the new file, or that it lacks, counts as regressed.
+ *         Prints one line per metric and exits 1 if any regressed.
+ *
+ * Baseline files are tab-separated text: a "# mm-baseline <version>" line,
+ * "# key value" metadata lines, a column header, then one row per metric:
+ *     suite case metric better median mad n
+ * where better is "higher" or "lower", and median reads "failed" for a case
+ * that failed.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BASELINE_VERSION 1
+#define LINE 1024
+
+typedef struct {
+    char suite[16];         /* replay or micro */
+    char name[128];         /* trace, or bench/param */
+    char metric[32];
+    int higher;             /* higher values are better */
+    int n;                  /* runs behind the row */
+    int failed;             /* runs that failed */
+    int samples;            /* while recording: values in v */
+    double *v;
+    double median, mad;     /* while recording: mad is the largest one a result reported */
+} row_t;
+
+typedef struct {
+    row_t *row;
+    int count, cap;
+} table_t;
+
+static row_t *find_row(table_t *t, const char *suite, const char *name, const char *metric) {
+    for (int i = 0; i < t->count; i++)
+        if (!strcmp(t->row[i].suite, suite) && !strcmp(t->row[i].name, name)
+                && !strcmp(t->row[i].metric, metric))
+            return &t->row[i];
+    return NULL;
+}
+
+static row_t *add_row(table_t *t, const char *suite, const char *name, const char *metric, int higher) {
+    row_t *r;
+
+    if (t->count == t->cap) {
+        t->cap = t->cap ? 2 * t->cap : 64;
+        t->row = realloc(t->row, t->cap * sizeof(row_t));
+    }
+    r = &t->row[t->count++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->suite, sizeof(r->suite), "%s", suite);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    snprintf(r->metric, sizeof(r->metric), "%s", metric);
+    r->higher = higher;
+    return r;
+}
+
+/* Add a value of metric that summarizes reps runs with deviation mad */
+static void add_sample(table_t *t, const char *suite, const char *name, const char *metric,
+                       int higher, double value, double mad, int reps) {
+    row_t *r = find_row(t, suite, name, metric);
+
+    if (r == NULL)
+        r = add_row(t, suite, name, metric, higher);
+    r->v = realloc(r->v, (r->samples + 1) * sizeof(double));
+    r->v[r->samples++] = value;
+    r->n += reps;
+    r->mad = fmax(r->mad, mad);
+}
+
+/* Count a failed run of metric */
+static void add_failure(table_t *t, const char *suite, const char *name, const char *metric, int higher) {
+    row_t *r = find_row(t, suite, name, metric);
+
+    if (r == NULL)
+        r = add_row(t, suite, name, metric, higher);
+    r->failed++;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double median(double *v, int n) {
+    qsort(v, n, sizeof(double), cmp_double);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/* Split line in place at tabs into at most max fields, return the count */
+static int split(char *line, char **field, int max) {
+    int n = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (n < max) {
+        field[n++] = line;
+        if ((line = strchr(line, '\t')) == NULL)
+            break;
+        *line++ = '\0';
+    }
+    return n;
+}
+
+/*
+ * read_result - Add the rows of an mmbench or microbench output file to t,
+ *               telling them apart by their column header
+ */
+static int read_result(const char *path, table_t *t) {
+    FILE *f = fopen(path, "r");
+    char line[LINE], *field[16];
+    int micro = -1, n;
+
+    if (f == NULL) {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        n = split(line, field, 16);
+        if (n >= 5 && !strcmp(field[0], "variant")) {
+            micro = !strcmp(field[1], "bench");
+            if (!micro && strcmp(field[3], "util")) {
+                fprintf(stderr, "Error: %s is not plain mmbench or microbench output\n", path);
+                fclose(f);
+                return -1;
+            }
+            continue;
+        }
+        if (micro < 0 || n < 5 || !strcmp(field[4], "n/a"))
+            continue;
+        if (micro && n >= 8) {
+            char name[128];
+
+            snprintf(name, sizeof(name), "%s/%s", field[1], field[2]);
+            if (!strcmp(field[4], "failed")) {
+                add_failure(t, "micro", name, "ns_per_op", 0);
+                add_failure(t, "micro", name, "heap_bytes", 0);
+                continue;
+            }
+            add_sample(t, "micro", name, "ns_per_op", 0, atof(field[4]), atof(field[6]), atoi(field[3]));
+            add_sample(t, "micro", name, "heap_bytes", 0, atof(field[7]), 0, atoi(field[3]));
+        } else if (!micro && !strcmp(field[4], "failed")) {
+            add_failure(t, "replay", field[1], "util", 1);
+            add_failure(t, "replay", field[1], "kops_per_s", 1);
+        } else if (!micro) {
+            add_sample(t, "replay", field[1], "util", 1, atof(field[3]), 0, 1);
+            add_sample(t, "replay", field[1], "kops_per_s", 1, atof(field[4]), 0, 1);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int record(int argc, char **argv) {
+    table_t t = {0};
+    char *meta[32];
+    int metas = 0, c;
+    FILE *out;
+
+    while ((c = getopt(argc, argv, "m:")) != -1) {
+        if (c != 'm' || metas == 32 || strchr(optarg, '=') == NULL) {
+            fprintf(stderr, "usage: baseline record [-m key=value]... out.tsv result.tsv...\n");
+            return 2;
+        }
+        meta[metas++] = optarg;
+    }
+    if (argc - optind < 2) {
+        fprintf(stderr, "usage: baseline record [-m key=value]... out.tsv result.tsv...\n");
+        return 2;
+    }
+    for (int i = optind + 1; i < argc; i++)
+        if (read_result(argv[i], &t) < 0)
+            return 1;
+
+    if ((out = fopen(argv[optind], "w")) == NULL) {
+        fprintf(stderr, "Error: cannot write %s\n", argv[optind]);
+        return 1;
+    }
+    fprintf(out, "# mm-baseline %d\n", BASELINE_VERSION);
+    for (int i = 0; i < metas; i++)
+        fprintf(out, "# %.*s %s\n", (int)(strchr(meta[i], '=') - meta[i]), meta[i],
+                strchr(meta[i], '=') + 1);
+    fprintf(out, "suite\tcase\tmetric\tbetter\tmedian\tmad\tn\n");
+    for (int i = 0; i < t.count; i++) {
+        row_t *r = &t.row[i];
+
+        if (r->failed) {
+            fprintf(out, "%s\t%s\t%s\t%s\tfailed\t0\t%d\n", r->suite, r->name, r->metric,
+                    r->higher ? "higher" : "lower", r->n + r->failed);
+            free(r->v);
+            continue;
+        }
+        /* the spread across results counts too when they were repeated */
+        r->median = median(r->v, r->samples);
+        if (r->samples > 1) {
+            double *dev = malloc(r->samples * sizeof(double));
+            for (int s = 0; s < r->samples; s++)
+                dev[s] = fabs(r->v[s] - r->median);
+            r->mad = fmax(r->mad, median(dev, r->samples));
+            free(dev);
+        }
+        fprintf(out, "%s\t%s\t%s\t%s\t%.10g\t%.6g\t%d\n", r->suite, r->name, r->metric,
+                r->higher ? "higher" : "lower", r->median, r->mad, r->n);
+        free(r->v);
+    }
+    free(t.row);
+    return fclose(out) == 0 ? 0 : 1;
+}
+
+static int read_baseline(const char *path, table_t *t) {
+    FILE *f = fopen(path, "r");
+    char line[LINE], *field[8];
+    int version = -1;
+
+    if (f == NULL) {
+        fprintf(stderr, "Error: cannot open baseline %s\n", path);
+        return -1;
+    }
+    if (fgets(line, sizeof(line), f) == NULL || sscanf(line, "# mm-baseline %d", &version) != 1
+            || version != BASELINE_VERSION) {
+        fprintf(stderr, "Error: %s is not a version %d baseline\n", path, BASELINE_VERSION);
+        fclose(f);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#' || !strncmp(line, "suite\t", 6))
+            continue;
+        if (split(line, field, 8) == 7) {
+            row_t *r = add_row(t, field[0], field[1], field[2], !strcmp(field[3], "higher"));
+            r->failed = !strcmp(field[4], "failed");
+            r->median = atof(field[4]);
+            r->mad = atof(field[5]);
+            r->n = atoi(field[6]);
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+static int compare(int argc, char **argv) {
+    table_t base = {0}, cur = {0};
+    double rel = 0.05, abs_util = 0.01, k = 3;
+    int regressed = 0, c;
+
+    while ((c = getopt(argc, argv, "t:u:k:")) != -1) {
+        switch (c) {
+        case 't':
+            rel = atof(optarg);
+            break;
+        case 'u':
+            abs_util = atof(optarg);
+            break;
+        case 'k':
+            k = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: baseline compare [-t rel] [-u abs] [-k k] base.tsv new.tsv\n");
+            return 2;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "usage: baseline compare [-t rel] [-u abs] [-k k] base.tsv new.tsv\n");
+        return 2;
+    }
+    if (read_baseline(argv[optind], &base) < 0 || read_baseline(argv[optind + 1], &cur) < 0)
+        return 2;
+
+    printf("suite\tcase\tmetric\tbase\tnew\tchange\tstatus\n");
+    for (int i = 0; i < base.count; i++) {
+        row_t *b = &base.row[i];
+        row_t *r = find_row(&cur, b->suite, b->name, b->metric);
+        double worse, allowed;
+        const char *status;
+
+        if (r == NULL || r->failed) {
+            if (b->failed)
+                printf("%s\t%s\t%s\tfailed", b->suite, b->name, b->metric);
+            else
+                printf("%s\t%s\t%s\t%.10g", b->suite, b->name, b->metric, b->median);
+            printf("\t%s\t-\t%s\n", r ? "failed" : "-", r ? "FAILED" : "MISSING");
+            regressed = 1;
+            continue;
+        }
+        if (b->failed) {
+            printf("%s\t%s\t%s\tfailed\t%.10g\t-\tfixed\n", b->suite, b->name, b->metric, r->median);
+            continue;
+        }
+        worse = b->higher ? b->median - r->median : r->median - b->median;
+        allowed = !strcmp(b->metric, "util") ? abs_util : rel * fabs(b->median);
+        allowed = fmax(allowed, k * (b->mad + r->mad));
+        if (worse > allowed) {
+            status = "REGRESSED";
+            regressed = 1;
+        } else if (-worse > allowed)
+            status = "improved";
+        else
+            status = "ok";
+        printf("%s\t%s\t%s\t%.10g\t%.10g\t%+.2f%%\t%s\n", b->suite, b->name, b->metric,
+               b->median, r->median, b->median ? (r->median - b->median) / fabs(b->median) * 100 : 0,
+               status);
+    }
+    for (int i = 0; i < cur.count; i++) {
+        row_t *r = &cur.row[i];
+
+        if (find_row(&base, r->suite, r->name, r->metric) != NULL)
+            continue;
+        if (r->failed) {
+            printf("%s\t%s\t%s\t-\tfailed\t-\tFAILED\n", r->suite, r->name, r->metric);
+            regressed = 1;
+        } else
+            printf("%s\t%s\t%s\t-\t%.10g\t-\tnew\n", r->suite, r->name, r->metric, r->median);
+    }
+    free(base.row);
+    free(cur.row);
+    return regressed;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && !strcmp(argv[1], "record"))
+        return record(argc - 1, argv + 1);
+    if (argc >= 2 && !strcmp(argv[1], "compare"))
+        return compare(argc - 1, argv + 1);
+    fprintf(stderr, "usage: %s record|compare ...\n", argv[0]);
+    return 2;
+}
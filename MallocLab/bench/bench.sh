@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# bench.sh - Rerun the replay and microbenchmark suites on an mm.c variant and
+#            record the results as its baseline or check them against it
+#
+# Usage: bench.sh record|check variant.c trace_dir
+#
+# The variant is built with mmbench and microbench against the handout's memlib,
+# taken from $MEMLIB (default ./memlib.c, with memlib.h and config.h next to it).
+# record writes baselines/<dir>-<file>.tsv, e.g. baselines/final-mm.tsv for
+# ../final/mm.c, stamped with the git commit; check compares a fresh run to it
+# with baseline compare and exits 1 on a regression. $REPLAYS sets how often
+# the traces are replayed (default 5), extra $COMPARE flags go to baseline compare.
+#
+set -e
+
+[ $# -eq 3 ] && { [ "$1" = record ] || [ "$1" = check ]; } || {
+    echo "usage: $0 record|check variant.c trace_dir" >&2
+    exit 2
+}
+mode=$1
+variant=$2
+traces=$3
+here=$(cd "$(dirname "$0")" && pwd)
+memlib=${MEMLIB:-./memlib.c}
+replays=${REPLAYS:-5}
+name=$(basename "$(dirname "$variant")")-$(basename "$variant" .c)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+cflags="-O2 -I$here/../final -I$(dirname "$memlib")"
+gcc $cflags -o "$work/mmbench" "$here/mmbench.c" "$variant" "$memlib" -pthread
+gcc $cflags -o "$work/microbench" "$here/microbench.c" "$variant" "$memlib" -pthread
+gcc -O2 -o "$work/baseline" "$here/baseline.c" -lm
+
+i=0
+while [ $i -lt "$replays" ]; do
+    "$work/mmbench" -n "$name" -r 1 "$traces"/*.rep >> "$work/replay.tsv"
+    i=$((i + 1))
+done
+"$work/microbench" -n "$name" > "$work/micro.tsv"
+
+"$work/baseline" record -m "variant=$name" \
+    -m "commit=$(git -C "$here" rev-parse --short HEAD 2>/dev/null || echo unknown)" \
+    -m "date=$(date -u +%Y-%m-%dT%H:%M:%SZ)" -m "host=$(uname -n)" \
+    "$work/run.tsv" "$work/replay.tsv" "$work/micro.tsv"
+
+if [ "$mode" = record ]; then
+    mkdir -p "$here/baselines"
+    cp "$work/run.tsv" "$here/baselines/$name.tsv"
+    echo "recorded $here/baselines/$name.tsv"
+else
+    "$work/baseline" compare $COMPARE "$here/baselines/$name.tsv" "$work/run.tsv"
+fi
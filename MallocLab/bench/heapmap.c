@@ -0,0 +1,194 @@
+/*
+ * heapmap.c - Render the heap maps written by mm_heap_map as an HTML page
+ *
+ * Build and run:
+ *     gcc -O2 -I../final -o heapmap heapmap.c
+ *     ./heapmap [-w width] map.bin > map.html
+ *
+ * Every snapshot in the file becomes one row of a heat map over the address
+ * range of the largest heap: each of width columns is colored by the fraction
+ * of its bytes that are free, from allocated (blue) to free (yellow), and gray
+ * past the end of that snapshot's heap. Below it a table per snapshot gives
+ * the free bytes, the largest free block, external fragmentation (1 - largest
+ * free / free) and the free bytes of each seglist.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_ext.h"
+
+#define WIDTH 512           /* default columns */
+#define ROW_HEIGHT 6        /* pixels per snapshot */
+
+typedef struct {
+    mm_map_header_t hdr;
+    uint64_t *word;
+} snapshot_t;
+
+typedef struct {
+    uint64_t free_bytes, alloc_bytes, movable_bytes;
+    uint64_t free_blocks, alloc_blocks, largest_free;
+    uint64_t class_free[MM_LISTMAX + 1];
+} stats_t;
+
+static snapshot_t *read_maps(const char *path, int *count) {
+    FILE *f = fopen(path, "rb");
+    snapshot_t *snaps = NULL;
+    int n = 0, cap = 0;
+    mm_map_header_t hdr;
+
+    if (f == NULL) {
+        fprintf(stderr, "Error: cannot open heap map %s\n", path);
+        return NULL;
+    }
+    while (fread(&hdr, sizeof(hdr), 1, f) == 1) {
+        if (hdr.magic != MM_MAP_MAGIC || hdr.version != MM_MAP_VERSION) {
+            fprintf(stderr, "Error: snapshot %d of %s is not a version %d heap map\n",
+                    n, path, MM_MAP_VERSION);
+            break;
+        }
+        if (n == cap) {
+            cap = cap ? 2 * cap : 16;
+            snaps = realloc(snaps, cap * sizeof(snapshot_t));
+        }
+        snaps[n].hdr = hdr;
+        snaps[n].word = malloc((hdr.blocks ? hdr.blocks : 1) * sizeof(uint64_t));
+        if (fread(snaps[n].word, sizeof(uint64_t), hdr.blocks, f) != hdr.blocks) {
+            fprintf(stderr, "Error: snapshot %d of %s is truncated\n", n, path);
+            free(snaps[n].word);
+            break;
+        }
+        n++;
+    }
+    fclose(f);
+    *count = n;
+    return snaps;
+}
+
+/*
+ * render_row - Stats of snapshot s, and one char per column of its heat map:
+ *              'a' (all allocated) to 'k' (all free), '.' past the heap end
+ */
+static void render_row(snapshot_t *s, uint64_t span, int width, char *row, stats_t *st) {
+    double *free_in = calloc(width, sizeof(double));
+    double col = (double)span / width;
+    uint64_t off = s->hdr.first;
+
+    memset(st, 0, sizeof(*st));
+    for (uint64_t i = 0; i < s->hdr.blocks; i++) {
+        uint64_t size = MM_MAP_SIZE(s->word[i]);
+        int state = MM_MAP_STATE(s->word[i]);
+
+        if (state == MM_MAP_FREE) {
+            st->free_bytes += size;
+            st->free_blocks++;
+            st->class_free[MM_MAP_CLASS(s->word[i]) % (MM_LISTMAX + 1)] += size;
+            if (size > st->largest_free)
+                st->largest_free = size;
+
+            /* spread the free bytes over the columns the block covers */
+            for (int c = off / col; c < width && c * col < off + size; c++) {
+                double lo = c * col > off ? c * col : off;
+                double hi = (c + 1) * col < off + size ? (c + 1) * col : off + size;
+                free_in[c] += hi - lo;
+            }
+        } else {
+            st->alloc_bytes += size;
+            st->alloc_blocks++;
+            if (state == MM_MAP_MOVABLE)
+                st->movable_bytes += size;
+        }
+        off += size;
+    }
+
+    for (int c = 0; c < width; c++) {
+        if (c * col >= s->hdr.heap_size)
+            row[c] = '.';
+        else
+            row[c] = 'a' + (int)(free_in[c] / col * 10 + 0.5);
+    }
+    row[width] = '\0';
+    free(free_in);
+}
+
+int main(int argc, char **argv) {
+    int width = WIDTH, count, c;
+    uint64_t span = 0;
+    snapshot_t *snaps;
+    stats_t *stats;
+    char *row;
+
+    while ((c = getopt(argc, argv, "w:")) != -1) {
+        if (c != 'w' || (width = atoi(optarg)) <= 0) {
+            fprintf(stderr, "usage: %s [-w width] map.bin > map.html\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-w width] map.bin > map.html\n", argv[0]);
+        return 2;
+    }
+    if ((snaps = read_maps(argv[optind], &count)) == NULL)
+        return 1;
+    if (count == 0) {
+        fprintf(stderr, "Error: no snapshots in %s\n", argv[optind]);
+        return 1;
+    }
+    for (int i = 0; i < count; i++)
+        if (snaps[i].hdr.heap_size > span)
+            span = snaps[i].hdr.heap_size;
+
+    printf("<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>heap map %s</title>\n",
+           argv[optind]);
+    printf("<style>body{font-family:sans-serif} td,th{padding:2px 8px;text-align:right}"
+           " canvas{border:1px solid #888;image-rendering:pixelated}</style></head><body>\n");
+    printf("<h2>%s: %d snapshots, %llu bytes across</h2>\n", argv[optind], count,
+           (unsigned long long)span);
+    printf("<p>Rows are snapshots, oldest on top; columns are %.0f bytes each, "
+           "blue allocated to yellow free, gray past the heap end.</p>\n", (double)span / width);
+    printf("<canvas id=\"map\" width=\"%d\" height=\"%d\"></canvas>\n<script>\nconst rows = [\n",
+           width, count * ROW_HEIGHT);
+
+    stats = malloc(count * sizeof(stats_t));
+    row = malloc(width + 1);
+    for (int i = 0; i < count; i++) {
+        render_row(&snaps[i], span, width, row, &stats[i]);
+        printf("\"%s\",\n", row);
+    }
+    printf("];\nconst ctx = document.getElementById(\"map\").getContext(\"2d\");\n"
+           "rows.forEach((r, y) => { for (let x = 0; x < r.length; x++) {\n"
+           "  if (r[x] == \".\") ctx.fillStyle = \"#ddd\";\n"
+           "  else { const f = (r.charCodeAt(x) - 97) / 10;\n"
+           "    ctx.fillStyle = `rgb(${43 + f * 199}, ${76 + f * 117}, ${126 - f * 48})`; }\n"
+           "  ctx.fillRect(x, y * %d, 1, %d); } });\n</script>\n", ROW_HEIGHT, ROW_HEIGHT);
+
+    printf("<table><tr><th>snapshot</th><th>heap</th><th>allocated</th><th>movable</th>"
+           "<th>free</th><th>free blocks</th><th>largest free</th><th>fragmentation</th>");
+    for (int l = 0; l <= MM_LISTMAX; l++)
+        printf("<th>list %d free</th>", l);
+    printf("</tr>\n");
+    for (int i = 0; i < count; i++) {
+        stats_t *st = &stats[i];
+
+        printf("<tr><td>%llu</td><td>%llu</td><td>%llu</td><td>%llu</td><td>%llu</td>"
+               "<td>%llu</td><td>%llu</td><td>%.3f</td>",
+               snaps[i].hdr.seq, snaps[i].hdr.heap_size, (unsigned long long)st->alloc_bytes,
+               (unsigned long long)st->movable_bytes, (unsigned long long)st->free_bytes,
+               (unsigned long long)st->free_blocks, (unsigned long long)st->largest_free,
+               st->free_bytes ? 1 - (double)st->largest_free / st->free_bytes : 0);
+        for (int l = 0; l <= MM_LISTMAX; l++)
+            printf("<td>%llu</td>", (unsigned long long)st->class_free[l]);
+        printf("</tr>\n");
+    }
+    printf("</table>\n</body></html>\n");
+
+    for (int i = 0; i < count; i++)
+        free(snaps[i].word);
+    free(snaps);
+    free(stats);
+    free(row);
+    return 0;
+}
@@ -0,0 +1,334 @@
+/*
+ * microbench.c - Microbenchmarks of allocator primitives, for mm.c variants and glibc
+ *
+ * Build against a variant and the handout's memlib, or against glibc:
+ *     gcc -O2 -I../final -o microbench microbench.c ../final/mm.c memlib.c -pthread
+ *     gcc -O2 -I../final -o microbench-v3 microbench.c ../V3/optimized.c memlib.c -pthread
+ *     gcc -O2 -DGLIBC -o microbench-glibc microbench.c -pthread
+ *
+ * Usage: microbench [-n name] [-r reps] [bench...]
+ *
+ * Every benchmark runs once to warm up and then reps times (default 11) on a
+ * fresh heap. Prints one tab-separated line per benchmark and parameter: the
+ * median, minimum and median absolute deviation of the ns per operation over
+ * the reps, and for mm the heap size the last rep ended with; "failed" if the
+ * allocator returned NULL, "n/a" if the benchmark cannot run on it. The benchmarks:
+ *     churn       malloc and free one size in a loop
+ *     ascending   malloc sizes in increasing order, then free them all
+ *     descending  the same in decreasing order
+ *     random      random sizes and frees over a window of live blocks
+ *     realloc     grow buffers by small steps to their final size
+ *     prodcons    blocks malloced by one thread and freed by another; mm needs
+ *                 mm_maint_start for that, "n/a" for variants without it
+ *     frag        free every other block, then allocate bigger ones into the holes
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef GLIBC
+#define alloc_init() 0
+#define alloc_malloc malloc
+#define alloc_free free
+#define alloc_realloc realloc
+#define heap_bytes() 0
+#else
+#include "memlib.h"
+#include "mm.h"
+
+/* Extensions of the final allocator; NULL when the variant does not have them */
+extern int mm_maint_start(void) __attribute__((weak));
+extern void mm_maint_stop(void) __attribute__((weak));
+
+#define alloc_malloc mm_malloc
+#define alloc_free mm_free
+#define alloc_realloc mm_realloc
+#define heap_bytes() mem_heapsize()
+
+static int alloc_init(void) {
+    mem_reset_brk();
+    return mm_init();
+}
+#endif
+
+#define REPS 11
+#define LIVE 4096           /* live blocks of random and frag */
+#define RING 1024           /* slots between producer and consumer */
+
+typedef struct {
+    const char *name;
+    long param;             /* size or count the benchmark is run with */
+    long ops;               /* allocator calls of one run */
+    int (*run)(long param); /* returns -1 if the allocator failed */
+} bench_t;
+
+static uint64_t rng = 88172645463325252ull;
+
+static inline uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Writes one byte so the compiler keeps the block and the page is touched */
+static inline void touch(void *p) {
+    *(volatile char *)p = 1;
+}
+
+static int bench_churn(long size) {
+    for (int i = 0; i < 100000; i++) {
+        void *p = alloc_malloc(size);
+        if (p == NULL)
+            return -1;
+        touch(p);
+        alloc_free(p);
+    }
+    return 0;
+}
+
+static void *ptrs[LIVE * 4];
+
+static int bench_order(long step, int ascending) {
+    int n = LIVE;
+
+    for (int i = 0; i < n; i++) {
+        size_t size = (ascending ? i + 1 : n - i) * step;
+        if ((ptrs[i] = alloc_malloc(size)) == NULL)
+            return -1;
+        touch(ptrs[i]);
+    }
+    for (int i = 0; i < n; i++)
+        alloc_free(ptrs[i]);
+    return 0;
+}
+
+static int bench_ascending(long step) {
+    return bench_order(step, 1);
+}
+
+static int bench_descending(long step) {
+    return bench_order(step, 0);
+}
+
+static int bench_random(long max_size) {
+    memset(ptrs, 0, LIVE * sizeof(void *));
+    for (int i = 0; i < 100000; i++) {
+        int slot = next_rand() % LIVE;
+        if (ptrs[slot] != NULL)
+            alloc_free(ptrs[slot]);
+        if ((ptrs[slot] = alloc_malloc(1 + next_rand() % max_size)) == NULL)
+            return -1;
+        touch(ptrs[slot]);
+    }
+    for (int i = 0; i < LIVE; i++)
+        if (ptrs[i] != NULL)
+            alloc_free(ptrs[i]);
+    return 0;
+}
+
+/* 16 buffers grown side by side by step bytes at a time up to 64 KiB */
+static int bench_realloc(long step) {
+    size_t size = step;
+
+    for (int b = 0; b < 16; b++)
+        if ((ptrs[b] = alloc_malloc(size)) == NULL)
+            return -1;
+    for (size += step; size <= 65536; size += step) {
+        for (int b = 0; b < 16; b++) {
+            if ((ptrs[b] = alloc_realloc(ptrs[b], size)) == NULL)
+                return -1;
+            touch((char *)ptrs[b] + size - 1);
+        }
+    }
+    for (int b = 0; b < 16; b++)
+        alloc_free(ptrs[b]);
+    return 0;
+}
+
+static void *_Atomic ring[RING];
+static atomic_int prod_failed;
+
+static void *consumer(void *arg) {
+    long n = (long)arg;
+
+    for (long i = 0; i < n; i++) {
+        void *p;
+        while ((p = atomic_exchange(&ring[i % RING], NULL)) == NULL)
+            if (atomic_load(&prod_failed))
+                return NULL;
+        alloc_free(p);
+    }
+    return NULL;
+}
+
+static int bench_prodcons(long size) {
+    long n = 100000;
+    pthread_t t;
+
+    atomic_store(&prod_failed, 0);
+    pthread_create(&t, NULL, consumer, (void *)n);
+    for (long i = 0; i < n; i++) {
+        void *p = alloc_malloc(size);
+        if (p == NULL) {
+            atomic_store(&prod_failed, 1);
+            break;
+        }
+        touch(p);
+        while (atomic_load(&ring[i % RING]) != NULL)
+            ;
+        atomic_store(&ring[i % RING], p);
+    }
+    pthread_join(t, NULL);
+    return atomic_load(&prod_failed) ? -1 : 0;
+}
+
+/* fill with mixed sizes, free every other block, refill with 1.5x the sizes */
+static int bench_frag(long max_size) {
+    int n = LIVE;
+
+    for (int i = 0; i < n; i++) {
+        if ((ptrs[i] = alloc_malloc(16 + (i * 7919) % max_size)) == NULL)
+            return -1;
+        touch(ptrs[i]);
+    }
+    for (int i = 0; i < n; i += 2)
+        alloc_free(ptrs[i]);
+    for (int i = 0; i < n; i += 2) {
+        if ((ptrs[i] = alloc_malloc((16 + (i * 7919) % max_size) * 3 / 2)) == NULL)
+            return -1;
+        touch(ptrs[i]);
+    }
+    for (int i = 0; i < n; i++)
+        alloc_free(ptrs[i]);
+    return 0;
+}
+
+static const bench_t benches[] = {
+    {"churn", 16, 200000, bench_churn},
+    {"churn", 256, 200000, bench_churn},
+    {"churn", 4096, 200000, bench_churn},
+    {"ascending", 16, 2 * LIVE, bench_ascending},
+    {"descending", 16, 2 * LIVE, bench_descending},
+    {"random", 512, 200000, bench_random},
+    {"random", 8192, 200000, bench_random},
+    {"realloc", 64, 16 * 65536 / 64, bench_realloc},
+    {"realloc", 1024, 16 * 65536 / 1024, bench_realloc},
+    {"prodcons", 64, 200000, bench_prodcons},
+    {"frag", 1024, 3 * LIVE, bench_frag},
+};
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Median of the n sorted values of v */
+static double median(const double *v, int n) {
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/*
+ * run_bench - Time reps runs of b after a warm-up, each on a fresh heap. Fills
+ *             ns[] with ns per op, sorted; returns -1 if a run failed, -2 if
+ *             b cannot run on this allocator.
+ */
+static int run_bench(const bench_t *b, int reps, double *ns) {
+#ifndef GLIBC
+    int threaded = (b->run == bench_prodcons);
+
+    if (threaded && mm_maint_start == NULL)
+        return -2;
+#endif
+    for (int r = -1; r < reps; r++) {
+        double t;
+        int failed;
+
+        if (alloc_init() < 0)
+            return -1;
+#ifndef GLIBC
+        if (threaded)
+            mm_maint_start();
+#endif
+        t = now_ns();
+        failed = b->run(b->param);
+        t = now_ns() - t;
+#ifndef GLIBC
+        if (threaded)
+            mm_maint_stop();
+#endif
+        if (failed)
+            return -1;
+        if (r >= 0)
+            ns[r] = t / b->ops;
+    }
+    qsort(ns, reps, sizeof(double), cmp_double);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *variant = "mm";
+    int reps = REPS, c;
+    double *ns, *dev;
+
+    while ((c = getopt(argc, argv, "n:r:")) != -1) {
+        switch (c) {
+        case 'n':
+            variant = optarg;
+            break;
+        case 'r':
+            reps = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n name] [-r reps] [bench...]\n", argv[0]);
+            return 2;
+        }
+    }
+#ifndef GLIBC
+    mem_init();
+#endif
+    ns = malloc(reps * sizeof(double));
+    dev = malloc(reps * sizeof(double));
+
+    printf("variant\tbench\tparam\treps\tmedian_ns\tmin_ns\tmad_ns\theap_bytes\n");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        const bench_t *b = &benches[i];
+        int wanted = (optind == argc), status;
+        double med;
+
+        for (int a = optind; a < argc; a++)
+            wanted |= !strcmp(argv[a], b->name);
+        if (!wanted)
+            continue;
+
+        printf("%s\t%s\t%ld\t%d\t", variant, b->name, b->param, reps);
+        if ((status = run_bench(b, reps, ns)) < 0) {
+            const char *why = status == -2 ? "n/a" : "failed";
+            printf("%s\t%s\t%s\t%s\n", why, why, why, why);
+            fflush(stdout);
+            continue;
+        }
+        med = median(ns, reps);
+        for (int r = 0; r < reps; r++)
+            dev[r] = ns[r] > med ? ns[r] - med : med - ns[r];
+        qsort(dev, reps, sizeof(double), cmp_double);
+        printf("%.2f\t%.2f\t%.2f\t%zu\n", med, ns[0], median(dev, reps), (size_t)heap_bytes());
+        fflush(stdout);
+    }
+    free(ns);
+    free(dev);
+    return 0;
+}
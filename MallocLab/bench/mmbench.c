@@ -0,0 +1,718 @@
+/*
+ * mmbench.c - Replay malloc lab traces against an mm.c variant
+ *
+ * Build against any variant and the handout's memlib, e.g.
+ *     gcc -O2 -I../final -o mmbench mmbench.c ../final/mm.c memlib.c -pthread
+ *     gcc -O2 -I../final -o mmbench-v3 mmbench.c ../V3/optimized.c memlib.c
+ * Only the mm.h interface is used, so every variant links.
+ *
+ * Usage: mmbench [-n name] [-r reps] [-p] [-c sets:ways:line] [-t touch] [-f ops] [-m map] [-C] [-M] [-L] trace...
+ *     -n  variant name printed in the first column (default "mm")
+ *     -r  replays per trace, the fastest is reported (default 3)
+ *     -p  hardware counters per mm_malloc, mm_free and mm_realloc call; not with -c or -t
+ *     -c  simulate an LRU data cache of that geometry (default 64:8:64, a 32 KiB L1)
+ *         over the payload accesses of a touch pattern:
+ *     -t  fill    write every line of a payload when it is allocated (default)
+ *         recent  also read the first line of the RECENT latest live blocks per op
+ *         random  also read the first line of RANDOM random live blocks per op
+ *     -f  sample the heap's footprint every that many ops; payloads are written
+ *         when allocated, as the application would
+ *     -m  append an mm_heap_map snapshot to map every -f ops (1000 without -f),
+ *         for heapmap to render; one replay per trace
+ *     -C  allocate with mm_set_cache_coloring on, where the variant has it
+ *     -M  run the mm_maint_start thread, which trims and purges, where the variant has it
+ *     -L  print the mm_latency_enable histograms of each trace's replays to stderr,
+ *         where the variant has them
+ *
+ * Traces are in the CS:APP format: a header of heap size hint, ids, ops and
+ * weight, then one "a id size", "r id size" or "f id" per line.
+ *
+ * Prints tab-separated lines. By default one per trace with utilization (peak
+ * live payload over final heap size) and throughput. With -p one per trace and
+ * entry point with the mean counter deltas of a call, less the cost of reading
+ * the counters; "n/a" where perf_event_open is not allowed. With -c one per
+ * trace with the accesses and miss rate of the simulated cache. With -f one per
+ * sample: heap size and live payload, the bytes of the heap resident (mincore)
+ * and those written since the last sample (soft-dirty bits of /proc/self/pagemap,
+ * "n/a" where the kernel lacks them).
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+#define CALIBRATE 10000     /* empty regions timed to find the cost of a counter read */
+#define RECENT 8            /* blocks the recent pattern reads per op */
+#define RANDOM 8            /* blocks the random pattern reads per op */
+
+/* Extensions of the final allocator; NULL when the variant does not have them */
+extern int mm_set_cache_coloring(int enable) __attribute__((weak));
+extern int mm_maint_start(void) __attribute__((weak));
+extern void mm_maint_stop(void) __attribute__((weak));
+extern int mm_heap_map(const char *path) __attribute__((weak));
+extern int mm_latency_enable(int enable) __attribute__((weak));
+extern void mm_latency_reset(void) __attribute__((weak));
+extern void mm_latency_report(void) __attribute__((weak));
+
+enum { OP_MALLOC, OP_FREE, OP_REALLOC, OPS };
+
+static const char *op_names[OPS] = {"malloc", "free", "realloc"};
+
+typedef struct {
+    char type;              /* 'a', 'r' or 'f' */
+    int id;
+    size_t size;
+} trace_op_t;
+
+typedef struct {
+    const char *name;
+    int num_ids;
+    int num_ops;
+    trace_op_t *ops;
+} trace_t;
+
+/* Hardware counters, read as groups since a PMU cannot count them all at once;
+ * every group gets a replay of its own */
+#define GROUPS 2
+#define GROUP_SIZE 3
+#define EVENTS (GROUPS * GROUP_SIZE)
+#define CACHE_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} events[EVENTS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"l1d_misses", PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {"llc_misses", PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {"dtlb_misses", PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+};
+
+static int group_fd = -1;
+
+/* Set-associative data cache with LRU replacement, fed the payload accesses */
+enum { TOUCH_FILL, TOUCH_RECENT, TOUCH_RANDOM };
+
+static const char *touch_names[] = {"fill", "recent", "random"};
+
+typedef struct {
+    int sets, ways, line;
+    uint64_t *tag;          /* sets * ways lines, tag + 1 so that 0 is empty */
+    uint64_t *used;         /* clock of the last access of each line */
+    uint64_t clock;
+    uint64_t accesses, misses;
+} cache_t;
+
+static cache_t *cache;
+static int touch = TOUCH_FILL;
+static int coloring;
+
+/* Heap footprint every fp_every ops, 0 for none */
+typedef struct {
+    int op;
+    size_t heap;            /* mem_heapsize */
+    size_t live;            /* payload bytes the trace holds */
+    size_t resident;        /* bytes of heap pages in memory */
+    long dirty;             /* bytes of heap pages written since the last sample, -1 if unknown */
+} footprint_t;
+
+static int fp_every;
+static footprint_t *fp;
+static int fp_count;
+static int pagemap_fd = -1, clear_refs_fd = -1;
+static int maint;
+static const char *map_path;
+
+/* Live blocks for the touch patterns: packed in live_ids for random picks, with
+ * each id's slot (-1 if not live), and linked in allocation order for recent */
+static int *live_ids, *live_slot, live_count;
+static int *live_prev, *live_next, live_last = -1;
+
+/* counter values of the open group, laid out as PERF_FORMAT_GROUP reads them */
+typedef struct {
+    uint64_t nr;
+    uint64_t value[GROUP_SIZE];
+} sample_t;
+
+static trace_t *read_trace(const char *path) {
+    FILE *f = fopen(path, "r");
+    trace_t *t;
+    int weight;
+    long heap_hint;
+
+    if (f == NULL) {
+        fprintf(stderr, "Error: cannot open trace %s\n", path);
+        return NULL;
+    }
+    t = calloc(1, sizeof(trace_t));
+    t->name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    if (fscanf(f, "%ld %d %d %d", &heap_hint, &t->num_ids, &t->num_ops, &weight) != 4) {
+        fprintf(stderr, "Error: bad trace header in %s\n", path);
+        fclose(f);
+        free(t);
+        return NULL;
+    }
+    t->ops = malloc(t->num_ops * sizeof(trace_op_t));
+    for (int i = 0; i < t->num_ops; i++) {
+        trace_op_t *op = &t->ops[i];
+        int n;
+
+        if (fscanf(f, " %c %d", &op->type, &op->id) != 2)
+            n = 0;
+        else if (op->type == 'f')
+            n = 1;
+        else
+            n = fscanf(f, "%zu", &op->size);
+        if (n != 1 || op->id < 0 || op->id >= t->num_ids || !strchr("arf", op->type)) {
+            fprintf(stderr, "Error: bad op %d in %s\n", i, path);
+            fclose(f);
+            free(t->ops);
+            free(t);
+            return NULL;
+        }
+    }
+    fclose(f);
+    return t;
+}
+
+static cache_t *cache_create(int sets, int ways, int line) {
+    cache_t *c = calloc(1, sizeof(cache_t));
+
+    c->sets = sets;
+    c->ways = ways;
+    c->line = line;
+    c->tag = calloc((size_t)sets * ways, sizeof(uint64_t));
+    c->used = calloc((size_t)sets * ways, sizeof(uint64_t));
+    return c;
+}
+
+static void cache_reset(cache_t *c) {
+    memset(c->tag, 0, (size_t)c->sets * c->ways * sizeof(uint64_t));
+    memset(c->used, 0, (size_t)c->sets * c->ways * sizeof(uint64_t));
+    c->clock = c->accesses = c->misses = 0;
+}
+
+/* Access the line of addr, filling the least recently used way on a miss */
+static void cache_access(cache_t *c, uintptr_t addr) {
+    uint64_t tag = addr / c->line + 1;
+    size_t set = (size_t)(tag - 1) % c->sets * c->ways;
+    size_t victim = set;
+
+    c->accesses++;
+    c->clock++;
+    for (size_t w = set; w < set + c->ways; w++) {
+        if (c->tag[w] == tag) {
+            c->used[w] = c->clock;
+            return;
+        }
+        if (c->used[w] < c->used[victim])
+            victim = w;
+    }
+    c->misses++;
+    c->tag[victim] = tag;
+    c->used[victim] = c->clock;
+}
+
+/* Access every line of [p, p + size) */
+static void cache_range(cache_t *c, const char *p, size_t size) {
+    uintptr_t a = (uintptr_t)p / c->line * c->line;
+
+    for (; a < (uintptr_t)p + size; a += c->line)
+        cache_access(c, a);
+}
+
+static void live_add(int id) {
+    live_slot[id] = live_count;
+    live_ids[live_count++] = id;
+    live_prev[id] = live_last;
+    live_next[id] = -1;
+    if (live_last >= 0)
+        live_next[live_last] = id;
+    live_last = id;
+}
+
+static void live_remove(int id) {
+    int i = live_slot[id];
+
+    if (i < 0)
+        return;
+    live_ids[i] = live_ids[--live_count];
+    live_slot[live_ids[i]] = i;
+    live_slot[id] = -1;
+    if (live_prev[id] >= 0)
+        live_next[live_prev[id]] = live_next[id];
+    if (live_next[id] >= 0)
+        live_prev[live_next[id]] = live_prev[id];
+    else
+        live_last = live_prev[id];
+}
+
+/* Payload accesses of the touch pattern after an op on id */
+static void touch_op(trace_op_t *op, char **ptr, size_t *size) {
+    static uint64_t x = 88172645463325252ull;
+
+    if (op->type == 'f')
+        live_remove(op->id);
+    else {
+        live_remove(op->id);
+        if (ptr[op->id] == NULL)
+            return;
+        live_add(op->id);
+        cache_range(cache, ptr[op->id], size[op->id]);
+    }
+
+    if (touch == TOUCH_RECENT) {
+        int id = live_last;
+        for (int i = 0; i < RECENT && id >= 0; i++, id = live_prev[id])
+            cache_access(cache, (uintptr_t)ptr[id]);
+    } else if (touch == TOUCH_RANDOM && live_count > 0) {
+        for (int i = 0; i < RANDOM; i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            cache_access(cache, (uintptr_t)ptr[live_ids[x % live_count]]);
+        }
+    }
+}
+
+/* Open the soft-dirty interface and check that writes do set the bit */
+static void soft_dirty_open(void) {
+    static char probe[1 << 13];
+    char *page = (char *)(((uintptr_t)probe + 4095) & ~(uintptr_t)4095);
+    uint64_t entry = 0;
+
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (pagemap_fd >= 0 && clear_refs_fd >= 0 && write(clear_refs_fd, "4", 1) == 1) {
+        *(volatile char *)page = 1;
+        if (pread(pagemap_fd, &entry, sizeof(entry), (uintptr_t)page / 4096 * sizeof(entry)) == sizeof(entry)
+                && (entry >> 55 & 1))
+            return;
+    }
+    if (pagemap_fd >= 0)
+        close(pagemap_fd);
+    if (clear_refs_fd >= 0)
+        close(clear_refs_fd);
+    pagemap_fd = clear_refs_fd = -1;
+}
+
+/* Start a new soft-dirty window; gives up on soft-dirty if the kernel refuses */
+static void soft_dirty_clear(void) {
+    if (clear_refs_fd >= 0 && write(clear_refs_fd, "4", 1) != 1) {
+        close(pagemap_fd);
+        close(clear_refs_fd);
+        pagemap_fd = clear_refs_fd = -1;
+    }
+}
+
+/* Record the footprint of the heap after op i, then restart the soft-dirty window */
+static void footprint_sample(int i, size_t live) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t lo = (uintptr_t)mem_heap_lo() & ~(page - 1);
+    size_t pages = ((uintptr_t)mem_heap_hi() + 1 - lo + page - 1) / page;
+    footprint_t *f = &fp[fp_count++];
+    unsigned char *vec = malloc(pages ? pages : 1);
+    uint64_t entry[512];
+
+    f->op = i;
+    f->heap = mem_heapsize();
+    f->live = live;
+    f->resident = 0;
+    if (mem_heapsize() > 0 && mincore((void *)lo, pages * page, vec) == 0)
+        for (size_t p = 0; p < pages; p++)
+            f->resident += (vec[p] & 1) * page;
+    free(vec);
+
+    f->dirty = -1;
+    if (pagemap_fd < 0)
+        return;
+    f->dirty = 0;
+    for (size_t p = 0; p < pages; p += 512) {
+        size_t n = pages - p < 512 ? pages - p : 512;
+        if (pread(pagemap_fd, entry, n * sizeof(uint64_t), (lo / page + p) * sizeof(uint64_t))
+                != (ssize_t)(n * sizeof(uint64_t)))
+            break;
+        for (size_t e = 0; e < n; e++)
+            f->dirty += (entry[e] >> 55 & 1) * page;
+    }
+    soft_dirty_clear();
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Open counter group g of this process, user space only; -1 if not allowed */
+static int open_group(int g) {
+    struct perf_event_attr attr;
+    int leader = -1;
+
+    for (int i = 0; i < GROUP_SIZE; i++) {
+        int fd;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[g * GROUP_SIZE + i].type;
+        attr.config = events[g * GROUP_SIZE + i].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = (leader < 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        if ((fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0)) < 0) {
+            if (leader >= 0)
+                close(leader);
+            return -1;
+        }
+        if (leader < 0)
+            leader = fd;
+    }
+    return leader;
+}
+
+static inline void read_group(sample_t *s) {
+    if (read(group_fd, s, sizeof(*s)) != sizeof(*s))
+        memset(s, 0, sizeof(*s));
+}
+
+/* Add the counter deltas from a to b to sum */
+static inline void add_delta(double *sum, const sample_t *a, const sample_t *b) {
+    for (int i = 0; i < GROUP_SIZE; i++)
+        sum[i] += (double)(b->value[i] - a->value[i]);
+}
+
+/*
+ * replay - Run trace t against a fresh heap. With counters open, the deltas of
+ *          every call add to sum[op] and the calls to count[op]. Returns the
+ *          elapsed ns, or -1 if the allocator failed; *util gets the utilization.
+ */
+static double replay(trace_t *t, double sum[OPS][GROUP_SIZE], long count[OPS], double *util) {
+    char **ptr = calloc(t->num_ids, sizeof(char *));
+    size_t *size = calloc(t->num_ids, sizeof(size_t));
+    size_t live = 0, peak = 0;
+    sample_t a, b;
+    double start;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "Error: mm_init failed\n");
+        return -1;
+    }
+    if (coloring)
+        mm_set_cache_coloring(1);
+    if (maint)
+        mm_maint_start();
+    if (fp != NULL) {
+        fp_count = 0;
+        soft_dirty_clear();
+    }
+    if (cache != NULL) {
+        cache_reset(cache);
+        memset(live_slot, -1, t->num_ids * sizeof(int));
+        live_count = 0;
+        live_last = -1;
+    }
+    start = now_ns();
+    for (int i = 0; i < t->num_ops; i++) {
+        trace_op_t *op = &t->ops[i];
+        int kind = op->type == 'a' ? OP_MALLOC : op->type == 'f' ? OP_FREE : OP_REALLOC;
+        char *p = ptr[op->id];
+
+        if (group_fd >= 0)
+            read_group(&a);
+        if (kind == OP_MALLOC)
+            p = mm_malloc(op->size);
+        else if (kind == OP_FREE)
+            mm_free(p);
+        else
+            p = mm_realloc(p, op->size);
+        if (group_fd >= 0) {
+            read_group(&b);
+            add_delta(sum[kind], &a, &b);
+        }
+        if (count != NULL)
+            count[kind]++;
+
+        if (kind != OP_FREE && p == NULL && op->size != 0) {
+            fprintf(stderr, "Error: %s of %zu bytes failed at op %d of %s\n",
+                    op_names[kind], op->size, i, t->name);
+            if (maint)
+                mm_maint_stop();
+            free(ptr);
+            free(size);
+            return -1;
+        }
+        if (fp != NULL && kind != OP_FREE && p != NULL)
+            memset(p, op->id, op->size);
+        live -= size[op->id];
+        size[op->id] = kind == OP_FREE ? 0 : op->size;
+        live += size[op->id];
+        ptr[op->id] = kind == OP_FREE ? NULL : p;
+        if (live > peak)
+            peak = live;
+        if (cache != NULL)
+            touch_op(op, ptr, size);
+        if (fp != NULL && (i % fp_every == fp_every - 1 || i == t->num_ops - 1))
+            footprint_sample(i + 1, live);
+        if (map_path != NULL && i % (fp_every ? fp_every : 1000) == 0)
+            mm_heap_map(map_path);
+    }
+    start = now_ns() - start;
+    if (maint)
+        mm_maint_stop();
+    *util = mem_heapsize() ? (double)peak / mem_heapsize() : 0;
+    free(ptr);
+    free(size);
+    return start;
+}
+
+/* Mean counter deltas of an empty region of the open group */
+static void calibrate(double *cost) {
+    sample_t a, b;
+
+    memset(cost, 0, GROUP_SIZE * sizeof(double));
+    for (int i = 0; i < CALIBRATE; i++) {
+        read_group(&a);
+        read_group(&b);
+        add_delta(cost, &a, &b);
+    }
+    for (int i = 0; i < GROUP_SIZE; i++)
+        cost[i] /= CALIBRATE;
+}
+
+static void run_counters(const char *variant, trace_t *t) {
+    double sum[GROUPS][OPS][GROUP_SIZE], cost[GROUPS][GROUP_SIZE], util;
+    long count[GROUPS][OPS];
+    int have[GROUPS];
+
+    memset(sum, 0, sizeof(sum));
+    memset(count, 0, sizeof(count));
+    for (int g = 0; g < GROUPS; g++) {
+        if ((have[g] = (group_fd = open_group(g)) >= 0)) {
+            ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            calibrate(cost[g]);
+        }
+        if (replay(t, sum[g], count[g], &util) < 0)
+            have[g] = 0;
+        if (group_fd >= 0)
+            close(group_fd);
+        group_fd = -1;
+    }
+
+    for (int op = 0; op < OPS; op++) {
+        printf("%s\t%s\t%s\t%ld", variant, t->name, op_names[op], count[0][op]);
+        for (int g = 0; g < GROUPS; g++) {
+            for (int i = 0; i < GROUP_SIZE; i++) {
+                if (!have[g] || count[g][op] == 0)
+                    printf("\tn/a");
+                else {
+                    double mean = sum[g][op][i] / count[g][op] - cost[g][i];
+                    printf("\t%.1f", mean > 0 ? mean : 0);
+                }
+            }
+        }
+        printf("\n");
+    }
+}
+
+static void run_cache(const char *variant, trace_t *t) {
+    double util;
+
+    live_ids = malloc(t->num_ids * sizeof(int));
+    live_slot = malloc(t->num_ids * sizeof(int));
+    live_prev = malloc(t->num_ids * sizeof(int));
+    live_next = malloc(t->num_ids * sizeof(int));
+    if (replay(t, NULL, NULL, &util) < 0)
+        printf("%s\t%s\t%s\t%s\tfailed\tfailed\n", variant, t->name,
+               coloring ? "coloring" : "default", touch_names[touch]);
+    else
+        printf("%s\t%s\t%s\t%s\t%llu\t%.4f\n", variant, t->name,
+               coloring ? "coloring" : "default", touch_names[touch],
+               (unsigned long long)cache->accesses,
+               cache->accesses ? (double)cache->misses / cache->accesses : 0);
+    free(live_ids);
+    free(live_slot);
+    free(live_prev);
+    free(live_next);
+}
+
+static void run_footprint(const char *variant, trace_t *t) {
+    double util;
+
+    fp = malloc((t->num_ops / fp_every + 2) * sizeof(footprint_t));
+    if (replay(t, NULL, NULL, &util) < 0)
+        printf("%s\t%s\tfailed\n", variant, t->name);
+    else {
+        for (int i = 0; i < fp_count; i++) {
+            printf("%s\t%s\t%d\t%zu\t%zu\t%zu\t", variant, t->name, fp[i].op,
+                   fp[i].heap, fp[i].live, fp[i].resident);
+            if (fp[i].dirty < 0)
+                printf("n/a\n");
+            else
+                printf("%ld\n", fp[i].dirty);
+        }
+    }
+    free(fp);
+    fp = NULL;
+}
+
+static void run_plain(const char *variant, trace_t *t, int reps) {
+    double best = -1, util = 0;
+
+    for (int r = 0; r < reps; r++) {
+        double ns = replay(t, NULL, NULL, &util);
+        if (ns < 0) {
+            printf("%s\t%s\t%d\tfailed\tfailed\n", variant, t->name, t->num_ops);
+            return;
+        }
+        if (best < 0 || ns < best)
+            best = ns;
+    }
+    printf("%s\t%s\t%d\t%.4f\t%.0f\n", variant, t->name, t->num_ops, util,
+           best > 0 ? t->num_ops / (best / 1e9) / 1e3 : 0);
+}
+
+int main(int argc, char **argv) {
+    const char *variant = "mm";
+    int reps = 3, counters = 0, c;
+    int sets = 64, ways = 8, line = 64, simulate = 0, latency = 0;
+
+    while ((c = getopt(argc, argv, "n:r:pc:t:f:m:CML")) != -1) {
+        switch (c) {
+        case 'n':
+            variant = optarg;
+            break;
+        case 'r':
+            reps = map_path ? 1 : atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'p':
+            counters = 1;
+            break;
+        case 'c':
+            if (sscanf(optarg, "%d:%d:%d", &sets, &ways, &line) != 3 || sets <= 0
+                || ways <= 0 || line <= 0 || (line & (line - 1))) {
+                fprintf(stderr, "Error: bad cache geometry %s\n", optarg);
+                return 2;
+            }
+            simulate = 1;
+            break;
+        case 't':
+            for (touch = 0; touch <= TOUCH_RANDOM && strcmp(optarg, touch_names[touch]); touch++)
+                ;
+            if (touch > TOUCH_RANDOM) {
+                fprintf(stderr, "Error: unknown touch pattern %s\n", optarg);
+                return 2;
+            }
+            simulate = 1;
+            break;
+        case 'C':
+            if (mm_set_cache_coloring == NULL) {
+                fprintf(stderr, "Error: this variant has no cache coloring\n");
+                return 2;
+            }
+            coloring = 1;
+            break;
+        case 'f':
+            if ((fp_every = atoi(optarg)) <= 0) {
+                fprintf(stderr, "Error: bad sample interval %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'm':
+            if (mm_heap_map == NULL) {
+                fprintf(stderr, "Error: this variant has no heap map\n");
+                return 2;
+            }
+            map_path = optarg;
+            reps = 1;
+            break;
+        case 'M':
+            if (mm_maint_start == NULL) {
+                fprintf(stderr, "Error: this variant has no maintenance thread\n");
+                return 2;
+            }
+            maint = 1;
+            break;
+        case 'L':
+            if (mm_latency_enable == NULL) {
+                fprintf(stderr, "Error: this variant has no latency histograms\n");
+                return 2;
+            }
+            latency = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n name] [-r reps] [-p] [-c sets:ways:line] [-t touch] [-f ops] [-m map] [-C] [-M] [-L] trace...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-n name] [-r reps] [-p] [-c sets:ways:line] [-t touch] [-f ops] [-m map] [-C] [-M] [-L] trace...\n", argv[0]);
+        return 2;
+    }
+    /* the simulator's live block tables are only set up outside counter mode */
+    if (simulate && counters) {
+        fprintf(stderr, "Error: -p does not combine with -c or -t\n");
+        return 2;
+    }
+    if (simulate)
+        cache = cache_create(sets, ways, line);
+
+    mem_init();
+    if (counters) {
+        printf("variant\ttrace\top\tcalls");
+        for (int i = 0; i < EVENTS; i++)
+            printf("\t%s", events[i].name);
+        printf("\n");
+    } else if (cache != NULL)
+        printf("variant\ttrace\tpolicy\ttouch\taccesses\tmiss_rate\n");
+    else if (fp_every > 0) {
+        soft_dirty_open();
+        printf("variant\ttrace\top\theap_bytes\tlive_bytes\tresident_bytes\tdirty_bytes\n");
+    }
+    else
+        printf("variant\ttrace\tops\tutil\tkops_per_s\n");
+
+    for (int i = optind; i < argc; i++) {
+        trace_t *t = read_trace(argv[i]);
+        if (t == NULL)
+            return 1;
+        if (latency) {
+            mm_latency_reset();
+            mm_latency_enable(1);
+        }
+        if (counters)
+            run_counters(variant, t);
+        else if (cache != NULL)
+            run_cache(variant, t);
+        else if (fp_every > 0)
+            run_footprint(variant, t);
+        else
+            run_plain(variant, t, reps);
+        fflush(stdout);
+        if (latency) {
+            mm_latency_enable(0);
+            fprintf(stderr, "%s %s\n", variant, t->name);
+            mm_latency_report();
+        }
+        free(t->ops);
+        free(t);
+    }
+    return 0;
+}
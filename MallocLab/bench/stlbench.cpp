@@ -0,0 +1,86 @@
+/*
+ * stlbench.cpp - std::vector, std::map and std::list on mm::allocator vs std::allocator
+ *
+ * Build against the handout's memlib:
+ *     gcc -O2 -c -I../final ../final/mm.c memlib.c
+ *     g++ -O2 -std=c++17 -I../final -o stlbench stlbench.cpp mm.o memlib.o
+ *
+ * Prints one tab-separated line per container and allocator: the median
+ * nanoseconds per element over REPS runs.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include "memlib.h"
+}
+#include "mm.hpp"
+
+#define REPS 7
+#define ELEMS 100000
+
+template <template <class> class Alloc>
+static void run_vector(int n) {
+    std::vector<int, Alloc<int>> v;
+    for (int i = 0; i < n; i++)
+        v.push_back(i);
+}
+
+template <template <class> class Alloc>
+static void run_map(int n) {
+    std::map<int, int, std::less<int>, Alloc<std::pair<const int, int>>> m;
+    for (int i = 0; i < n; i++)
+        m[(i * 7919) % n] = i;
+    for (int i = 0; i < n; i += 2)
+        m.erase(i);
+    for (int i = 0; i < n; i += 2)
+        m[i] = i;
+}
+
+template <template <class> class Alloc>
+static void run_list(int n) {
+    std::list<int, Alloc<int>> l;
+    for (int i = 0; i < n; i++)
+        l.push_back(i);
+    for (auto it = l.begin(); it != l.end();)
+        it = (*it % 3) ? l.erase(it) : std::next(it);
+    for (int i = 0; i < n; i++)
+        l.push_front(i);
+}
+
+/* median ns per element of REPS calls to run(n) */
+static double measure(void (*run)(int), int n) {
+    double ns[REPS];
+
+    for (int r = 0; r < REPS; r++) {
+        auto start = std::chrono::steady_clock::now();
+        run(n);
+        auto stop = std::chrono::steady_clock::now();
+        ns[r] = std::chrono::duration<double, std::nano>(stop - start).count() / n;
+    }
+    std::sort(ns, ns + REPS);
+    return ns[REPS / 2];
+}
+
+int main(void) {
+    mem_init();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        return 1;
+    }
+
+    printf("container\tallocator\telements\tns_per_elem\n");
+    printf("vector\tstd\t%d\t%.2f\n", ELEMS, measure(run_vector<std::allocator>, ELEMS));
+    printf("vector\tmm\t%d\t%.2f\n", ELEMS, measure(run_vector<mm::allocator>, ELEMS));
+    printf("map\tstd\t%d\t%.2f\n", ELEMS, measure(run_map<std::allocator>, ELEMS));
+    printf("map\tmm\t%d\t%.2f\n", ELEMS, measure(run_map<mm::allocator>, ELEMS));
+    printf("list\tstd\t%d\t%.2f\n", ELEMS, measure(run_list<std::allocator>, ELEMS));
+    printf("list\tmm\t%d\t%.2f\n", ELEMS, measure(run_list<mm::allocator>, ELEMS));
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * thpbench.c - dTLB misses of random accesses over a large mm heap, with the
+ *              huge page layout (mm_set_huge_pages) off and on
+ *
+ * Build against a memlib whose MAX_HEAP (config.h) covers HEAP_BYTES:
+ *     gcc -O2 -I../final -o thpbench thpbench.c ../final/mm.c memlib.c -pthread
+ *
+ * Each mode runs in its own child so the pages of one do not carry over to the
+ * other. Prints one tab-separated line per mode: dTLB load misses and ns per
+ * access, and the AnonHugePages the process ended up with. Misses read "n/a"
+ * where perf_event_open is not allowed (see perf_event_paranoid).
+ */
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+#include "mm_ext.h"
+
+#define HEAP_BYTES (1L << 30)   /* live objects, roughly */
+#define OBJ_MIN 64
+#define OBJ_MAX 256
+#define ACCESSES 20000000L
+
+/* counter for dTLB read misses of this process, -1 if unavailable */
+static int open_dtlb(void) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* AnonHugePages of this process in kB */
+static long anon_huge_kb(void) {
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kb = -1;
+
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    fclose(f);
+    return kb;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(int huge) {
+    size_t n = HEAP_BYTES / ((OBJ_MIN + OBJ_MAX) / 2);
+    char **obj = malloc(n * sizeof(char *));
+    uint64_t misses = 0, x = 88172645463325252ull;
+    long sum = 0;
+    double t;
+    int fd;
+
+    mem_init();
+    mm_init();
+    mm_set_huge_pages(huge);
+    for (size_t i = 0; i < n; i++) {
+        size_t size = OBJ_MIN + i % (OBJ_MAX - OBJ_MIN + 1);
+        if ((obj[i] = mm_malloc(size)) == NULL) {
+            fprintf(stderr, "out of heap after %zu objects, raise MAX_HEAP\n", i);
+            exit(1);
+        }
+        memset(obj[i], (int)i, size);
+    }
+
+    fd = open_dtlb();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    t = now_ns();
+    for (long i = 0; i < ACCESSES; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        sum += obj[x % n][0];
+    }
+    t = now_ns() - t;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            fd = -1;
+    }
+
+    printf("%s\t", huge ? "huge" : "4k");
+    if (fd >= 0)
+        printf("%llu", (unsigned long long)misses);
+    else
+        printf("n/a");
+    printf("\t%.2f\t%ld\n", t / ACCESSES, anon_huge_kb());
+    fflush(stdout);
+    if (sum == 42)
+        fprintf(stderr, "\n");
+}
+
+int main(void) {
+    printf("layout\tdtlb_misses\tns_per_access\tanon_huge_kb\n");
+    fflush(stdout);
+    for (int huge = 0; huge <= 1; huge++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(huge);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
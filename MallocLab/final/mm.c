@@ -5,12 +5,13 @@
  *
  * Each block has header and footer of the form:
  *
- *      63       32   31        1   0
- *      --------------------------------
- *     |   unused   | block_size | a/f |
- *      --------------------------------
+ *      63       43 42    32 31        1   0
+ *      ----------------------------------------
+ *     |  size_hi  | flags  | block_size | a/f |
+ *      ----------------------------------------
  *
- * a/f is 1 iff the block is allocated. The list has the following form:
+ * a/f is 1 iff the block is allocated. The size is size_hi:block_size, so a
+ * block can be up to 2^52 bytes; use GET_SIZE and PACK, never the fields. The list has the following form:
  *
  * begin                                       end
  * heap                                       heap
@@ -32,12 +33,28 @@
 
 #include "memlib.h"
 #include "mm.h"
+#include "mm_ext.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include <assert.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Your info */
@@ -53,7 +70,11 @@ team_t team = {
 typedef struct {
     uint32_t allocated : 1;
     uint32_t block_size : 31;
-    uint32_t _;
+    uint32_t heap_id : 8;   /* heaps[] index of the heap owning an allocated block */
+    uint32_t tracked : 1;   /* allocated block has an entry in the lifetime predictor */
+    uint32_t movable : 1;   /* allocated block belongs to a handle, see mm_halloc */
+    uint32_t sampled : 1;   /* allocated block is in the heap profile, see prof_sample */
+    uint32_t size_hi : 21;  /* size bits 31 and up */
 } header_t;
 
 typedef header_t footer_t;
@@ -61,16 +82,71 @@ typedef header_t footer_t;
 typedef struct {
     uint32_t allocated : 1;
     uint32_t block_size : 31;
-    uint32_t _;
+    uint32_t heap_id : 8;
+    uint32_t tracked : 1;
+    uint32_t movable : 1;
+    uint32_t sampled : 1;
+    uint32_t size_hi : 21;
     union {
         struct {
-            struct block_t* next;   //each seghead will be a block_t, next points to the first element
-            struct block_t* prev;
+            uint64_t next;  //each seghead will be a block_t, next points to the first element
+            uint64_t prev;  //links are heap_base offsets, 0 for none, see LINK
         };
         int payload[0]; 
     } body; //What's the alignment requirement and memory requirement of body
 } block_t;
 
+/* Sub-heaps grow by extents, allocated blocks of the main heap laid out as
+ *
+ *  ------------------------------------------------------------------
+ * | extent_t | hdr(8:a) | [seglist heads] | usr blks | hdr(0:a) |
+ *  ------------------------------------------------------------------
+ *
+ * The seglist heads only live in the first extent of each sub-heap. */
+typedef struct extent {
+    struct extent *next;
+    struct extent *prev;
+} extent_t;
+
+/* A heap is a prologue/segList/epilogue triple. The globals below always describe
+ * the active heap; use_heap() parks them in its heap_t and loads another one. */
+typedef struct mm_heap {
+    block_t *prologue;
+    block_t *segList;
+    block_t *epilogue;
+    extent_t *extents;      /* sub-heaps only, newest first */
+    int id;                 /* index in heaps[], kept in allocated block headers */
+} heap_t;
+
+/* Lifetime predictor slot, keyed by call site and log2 of the request size */
+typedef struct {
+    uintptr_t key;
+    uint32_t count;         /* allocations seen */
+    uint32_t samples;       /* sampled blocks freed so far */
+    uint64_t mean;          /* moving average lifetime, in placed blocks */
+} site_t;
+
+/* Arena chunks are ordinary mm_malloc blocks, newest first */
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    void *end;
+} arena_chunk_t;
+
+struct mm_arena {
+    arena_chunk_t *chunks;
+    void *top;              /* bump pointer into chunks */
+    void *end;
+    size_t chunk_size;
+};
+
+/* Handle table entry. The payload of a handle block starts with its table index,
+ * the caller's data follows it. Free entries are chained through next_free. */
+typedef struct {
+    void *payload;
+    uint32_t locks;
+    uint32_t next_free;
+} handle_t;
+
 /* This enum can be used to set the allocated bit in the block */
 enum block_state { FREE,
                    ALLOC };
@@ -80,19 +156,93 @@ enum block_state { FREE,
 #define WSIZE 4
 #define DSIZE 8
 
-#define LISTMAX 5
-#define MINSIZE 3998
+#define LISTMAX MM_LISTMAX
+#define MINSIZE MM_MINSIZE
+#define FIT_SLOTS 64        /* free blocks per seglist in the best-fit index, multiple of 8 */
 #define CHUNKSIZE (1 << 8) /* initial heap size (bytes) */
+#define NT_ZERO_MIN (1 << 18) /* calloc zeroes blocks this big with non-temporal stores */
+#define COLOR_MIN (1 << 16) /* blocks this big get a cache color */
+#define COLOR_SPAN 4096     /* colors rotate the payload through the lines of this span */
+#define HUGE_PAGE ((size_t)1 << 21) /* transparent huge page size */
+
+#define ARENA_CHUNK (1 << 12) /* default arena chunk payload */
+
+#define LIMBO_SLOTS 126     /* deferred frees per limbo chunk, 1 KiB chunks */
+#define MAX_READERS 64      /* threads that may use mm_epoch_enter */
+
+#define QUICK_MAX 256       /* largest block size with a quick list */
+#define QUICK_FILL 32       /* blocks the maintenance thread keeps on a quick list */
+#define QUICK_LISTS ((QUICK_MAX - MIN_BLOCK_SIZE) / DSIZE + 1)
+#define QUICK_LIST(size) (((size) - MIN_BLOCK_SIZE) / DSIZE)
+#define DRAIN_BATCH 256     /* queued frees handed to mm_free_batch at once */
+#define TRIM_MIN (1 << 16)  /* trailing free space the maintenance thread purges */
+#define MAINT_PERIOD_US 1000
+
+/* Entry points lock the heap only while the maintenance thread runs, and count
+ * themselves in a heap file so that a crash inside one is seen on the next attach */
+#define HEAP_LOCK()     do { if (maint_active) pthread_mutex_lock(&heap_lock); pheap_enter(); } while (0)
+#define HEAP_UNLOCK()   do { pheap_leave(); if (maint_active) pthread_mutex_unlock(&heap_lock); } while (0)
+
+#define PHEAP_MAGIC 0x50414548504d4dull /* "MMPHEAP" */
+#define PHEAP_VERSION 4
+#define PHEAP_HDR ((sizeof(pheap_t) + 4095) & ~(size_t)4095) /* the heap starts this far into the file */
+#define PHEAP_GROW (1 << 20) /* the file grows in steps of this much */
+#define SHM_WAIT_MS 1000    /* how long mm_shm_attach waits for mm_shm_create to finish */
+
+#define HANDLE_WORD sizeof(uint64_t) /* table index in front of handle block data */
+#define HANDLES_INIT 64     /* first handle table size */
+
+#define MAX_HEAPS 256       /* heap_id is 8 bits */
+#define EXTENT_SIZE (1 << 14) /* minimum extent a sub-heap carves from the main heap */
+#define EXTENT_OVERHEAD (sizeof(extent_t) + 2 * sizeof(header_t)) /* link, prologue and epilogue */
+
+#define PROF_PERIOD (1 << 19) /* default mean bytes between profile samples */
+#define PROF_DEPTH 24       /* frames kept per call site */
+#define PROF_SKIP 2         /* frames of prof_sample and the entry point */
+#define PROF_SITES 1024     /* distinct call sites, power of two */
+#define PROF_LIVE_BITS 14
+#define PROF_LIVE (1 << PROF_LIVE_BITS) /* sampled blocks alive at once, kept 3/4 full at most */
+#define PROF_HASH(p)    (uint32_t)((((uintptr_t)(p) >> 3) * 0x9E3779B97F4A7C15ull) >> (64 - PROF_LIVE_BITS))
+
+/* Count an allocation towards the next profile sample; under the heap lock */
+#define PROF_HOOK(payload, size) \
+    do { if (prof_on && (prof_left -= (int64_t)(size)) < 0) prof_sample(payload, size); } while (0)
+
+#define LAT_SUB_BITS 3     /* each power of two of ticks is split into 1 << LAT_SUB_BITS buckets */
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) << LAT_SUB_BITS)
+
+/* Time a stretch of code into latency histogram op; t is 0 while timing is off */
+#define LAT_BEGIN(t)    uint64_t t = lat_on ? lat_now() : 0
+#define LAT_END(op, t)  do { if (t) lat_record(op, lat_now() - (t)); } while (0)
+
+#define GROW_BITS 8
+#define GROW_SLOTS (1 << GROW_BITS) /* blocks mm_realloc tracks at once */
+#define GROW_SLOT(p)    (&grow[(((uintptr_t)(p) >> 3) * 0x9E3779B97F4A7C15ull) >> (64 - GROW_BITS)])
+#define GROW_AFTER 2        /* reallocs that grow a block before it gets headroom */
+#define GROW_SPARE_MAX (1 << 20) /* most headroom one block gets */
+
+#define PRESSURE_SLOTS 8    /* pressure callbacks registered at once */
+#define MINCORE_PAGES 256   /* pages resident_bytes asks mincore about at once */
+
+#define PRED_SITES 256      /* predictor slots */
+#define PRED_LIVE 64        /* sampled blocks alive at once */
+#define PRED_PERIOD 16      /* sample one in PRED_PERIOD allocations of a site */
+#define PRED_SHORT 4096     /* sites whose blocks die within this many allocations are short-lived */
+#define PRED_SLOT(key)  (&sites[(((key) >> 4) * 0x9E3779B97F4A7C15ull) >> 56 & (PRED_SITES - 1)])
 
 #define OVERHEAD (sizeof(header_t) + sizeof(footer_t)) /* overhead of the header and footer of an allocated block */
 #define MIN_BLOCK_SIZE (32) /* the minimum block size needed to keep in a freelist (header + footer + next pointer + prev pointer) */
+_Static_assert(OVERHEAD == MM_OVERHEAD && MIN_BLOCK_SIZE == MM_MIN_BLOCK, "mm_ext.h out of date");
 #define MAX(x,y) ((x) > (y) ? (x) : (y))
 #define MIN(x,y) ((x) > (y) ? (y) : (x))
 
-#define PACK(p, size, alloc)    ((p)->block_size = size, (p)->allocated = alloc)
+#define PACK(p, size, alloc)    pack((p), (size), (alloc))
+#define SIZE_LO_BITS 31
+#define MAX_BLOCK_SIZE (((size_t)1 << (SIZE_LO_BITS + 21)) - DSIZE)
 
 /* Read the size and allocated fields from address p */
-#define GET_SIZE(p)  (((block_t *)(p))->block_size)    //get size in BYTES
+#define GET_SIZE(p)  ((size_t)((header_t *)(p))->size_hi << SIZE_LO_BITS | ((header_t *)(p))->block_size)    //get size in BYTES
 #define GET_ALLOC(p) (((block_t *)(p))->allocated)
 
 /* Given block ptr bp, compute address of its header and footer */
@@ -105,6 +255,14 @@ enum block_state { FREE,
 #define NEXT_BLKP(bp)   ((void *)(bp) + GET_SIZE(bp))  //points to the beginning of the block, not the payload
 #define PREV_BLKP(bp)   ((void *)(bp) - GET_SIZE(PREV_FTRP(bp)))
 
+/* Free list links are offsets from heap_base, so a heap file can be mapped anywhere */
+#define LINK(p)     ((p) != NULL ? (uint64_t)((void *)(p) - heap_base) : 0)
+#define UNLINK(off) ((off) != 0 ? heap_base + (off) : NULL)
+#define NEXT_FREE(bp)           ((block_t *)UNLINK((bp)->body.next))
+#define PREV_FREE(bp)           ((block_t *)UNLINK((bp)->body.prev))
+#define SET_NEXT_FREE(bp, p)    ((bp)->body.next = LINK(p))
+#define SET_PREV_FREE(bp, p)    ((bp)->body.prev = LINK(p))
+
 
 /* Global variables */
 static block_t *prologue; /* pointer to first block */
@@ -112,8 +270,201 @@ static block_t *segList;    /* pointer to the first seglist */
 static block_t *epilogue;
 /* seglist usage: each segList initial block contains its own Root (->body.next) and own tail(->body.prev); it is not pointed to by any free blocks. */
 
+/* Zeroing elision for mm_calloc. memlib hands out a fresh anonymous mapping, so heap
+ * memory is zero until we write it. Every byte from clean_top up to the epilogue has
+ * never been part of an allocated block; the only words written there are the tags and
+ * links of the free block covering it, and coalescing scrubs those once they are dead. */
+static void *clean_top;     /* lowest address that was never handed out */
+static void *brk_max;       /* highest brk seen on this memlib region */
+static void *brk_base;      /* mem_heap_lo() of that region */
+
+/* Side index of a main-heap seglist: sizes and heap offsets of up to FIT_SLOTS of its
+ * free blocks, packed so find_fit can compare eight sizes per instruction. Slots past
+ * count hold size 0, which never fits. Blocks inserted while the index is full are
+ * only on the list and counted in unindexed. */
+typedef struct {
+    uint32_t size[FIT_SLOTS];
+    uint32_t off[FIT_SLOTS];
+    int count;
+    int unindexed;
+} fit_index_t;
+
+/* Header of a heap file (mm_init_from_file), mapped MAP_SHARED at its start. The
+ * heap follows at PHEAP_HDR; it and everything here are position independent. */
+typedef struct {
+    uint64_t magic;         /* written last when the file is created */
+    uint32_t version;
+    uint32_t hdr_size;      /* sizeof(pheap_t), catches layout changes */
+    uint64_t size;          /* bytes mapped, the heap cannot grow past it */
+    uint64_t brk;           /* end of the heap, from the start of the file */
+    uint64_t root;          /* caller's root object, 0 if none */
+    uint32_t busy;          /* entry points running; nonzero on attach: one crashed */
+    uint32_t shared;        /* made by mm_shm_create, lock is in use */
+    pthread_mutex_t lock;   /* robust, process-shared */
+    fit_index_t index[LISTMAX + 1]; /* fit index of the heap, kept with it */
+} pheap_t;
+
+static void *heap_base;     /* free list links are offsets from here */
+static pheap_t *pheap;      /* the heap file, NULL while the heap is memlib's */
+static int pheap_fd;
+static size_t pheap_len;    /* current length of the heap file */
+
+/* The globals above plus the heap triple, saved while a shared heap is swapped in */
+typedef struct {
+    void *heap_base;
+    pheap_t *pheap;
+    int pheap_fd;
+    size_t pheap_len;
+    fit_index_t *fit_index;
+    block_t *prologue;
+    block_t *segList;
+    block_t *epilogue;
+    void *clean_top;
+} heap_ctx_t;
+
+/* Shared heap as seen by one process; its mapping address differs per process */
+struct mm_shm {
+    heap_ctx_t ctx;
+    heap_ctx_t own;         /* the process's heap while ctx is swapped in */
+};
+
+/* Cache coloring of large blocks, off until mm_set_cache_coloring */
+static bool cache_coloring;
+static int color_next;      /* line offset within COLOR_SPAN of the next large payload */
+
+/* Huge page layout, off until mm_set_huge_pages: the heap grows to HUGE_PAGE
+ * boundaries, asks for transparent huge pages and keeps slabs inside one */
+static bool huge_pages;
+
+/* Best-fit side index of the main heap's seglists and the scan find_fit uses on it */
+static fit_index_t fit_index_mem[LISTMAX + 1];
+static fit_index_t *fit_index = fit_index_mem;   /* pheap->index for a heap file */
+static int (*best_fit_scan)(const uint32_t *size, int count, uint32_t asize);
+
+/* Heaps: heaps[0] is the main heap, the lifetime classes get a sub-heap each and
+ * the rest of heaps[] holds the ones made by mm_heap_create */
+static heap_t main_heap;
+static heap_t lifetime_heaps[MM_LIFETIME_LONG];
+static heap_t *heaps[MAX_HEAPS];
+static heap_t *cur_heap = &main_heap;
+
+/* Lifetime predictor for MM_LIFETIME_AUTO */
+static site_t sites[PRED_SITES];
+static struct {
+    void *payload;
+    uintptr_t key;
+    uint64_t born;
+} pred_live[PRED_LIVE];
+static uint64_t alloc_clock;    /* blocks placed so far */
+
+/* Heap profile call site: a stack and the sampled blocks allocated from it */
+typedef struct {
+    uint64_t hash;          /* of the frames, 0 for an empty slot */
+    int depth;
+    void *pc[PROF_DEPTH];
+    size_t live_count;      /* sampled blocks not freed yet */
+    size_t live_bytes;
+    size_t alloc_count;     /* all sampled blocks */
+    size_t alloc_bytes;
+} prof_site_t;
+
+/* Sampling heap profiler. An allocation is sampled when it crosses the end of a
+ * byte interval drawn from an exponential distribution with mean prof_period, so
+ * the chance of a block being sampled grows with its size like a Poisson process
+ * and pprof can scale the samples back up (heap_v2). Sampled blocks are hashed
+ * by payload in prof_live until they are freed. */
+static bool prof_on;
+static size_t prof_period = PROF_PERIOD;
+static int64_t prof_left;       /* bytes to go until the next sample */
+static uint64_t prof_rand = 88172645463325252ull;
+static prof_site_t prof_sites[PROF_SITES];
+static struct {
+    void *payload;          /* NULL for an empty slot */
+    uint32_t site;
+    size_t size;
+} prof_live[PROF_LIVE];
+static size_t prof_live_count;
+
+/* Blocks mm_realloc has grown, hashed by payload; a slot is only a hint and a
+ * colliding block takes it over. A block gets headroom of half its size once it
+ * has grown GROW_AFTER times, and mm_realloc_reclaim cuts it back to size. */
+typedef struct {
+    void *payload;          /* NULL for an empty slot */
+    uint32_t growths;
+    size_t size;            /* bytes the caller asked for last */
+} grow_t;
+
+static grow_t grow[GROW_SLOTS];
+static size_t grow_live;        /* slots in use */
+
+/* Callbacks that free the caller's caches under memory pressure: when the heap
+ * cannot grow and from mm_release_free_memory */
+static struct {
+    mm_pressure_fn fn;
+    void *arg;
+} pressure[PRESSURE_SLOTS];
+static int pressure_count;
+static bool in_pressure;        /* callbacks are running, a failed growth does not recurse */
+
+/* Latency histograms, one per mm_latency_op, log-bucketed like HdrHistogram: a
+ * power of two of ticks in LAT_SUB linear steps, so every bucket is within 1/LAT_SUB
+ * of its value. Counters are atomic since queued mm_free runs outside the lock. */
+static bool lat_on;
+static _Atomic uint64_t lat_hist[MM_LAT_OPS][LAT_BUCKETS];
+static _Atomic uint64_t lat_count[MM_LAT_OPS];
+static _Atomic uint64_t lat_max[MM_LAT_OPS];
+static double lat_tick_ns;      /* ns per tick, measured when timing is enabled */
+
+/* Limbo bag chunk of mm_free_deferred, a block of the main heap */
+typedef struct limbo {
+    struct limbo *next;
+    size_t count;
+    void *ptr[LIMBO_SLOTS];
+} limbo_t;
+
+/* Announced epoch of a reader thread: epoch << 1 | 1 while inside, 0 outside */
+typedef struct {
+    _Atomic uint64_t epoch;
+    _Atomic bool used;
+} __attribute__((aligned(MM_CACHELINE))) reader_t;
+
+/* Epoch-based reclamation: retired blocks wait in the bag of their epoch */
+static _Atomic uint64_t global_epoch;
+static reader_t readers[MAX_READERS];
+static _Thread_local int reader_slot = -1;
+static limbo_t *limbo[3];
+
+/* Maintenance thread. While it runs, mm_free only pushes the block onto free_queue
+ * (chained through the first payload word) and the thread frees, coalesces, trims
+ * and refills the quick lists off the callers' critical path. Quick lists hold
+ * allocated main-heap blocks of at least QUICK_LIST's size, chained the same way. */
+static bool maint_active;
+static _Atomic bool maint_stop;
+static pthread_t maint_thread;
+static pthread_mutex_t heap_lock;   /* recursive, entry points nest */
+static void *_Atomic free_queue;
+static void *quick[QUICK_LISTS];
+static int quick_count[QUICK_LISTS];
+static int quick_miss[QUICK_LISTS];
+static block_t *trimmed;            /* trailing free block purged last, and its size */
+static size_t trimmed_size;
+
+/* Handle table for movable blocks, itself a block of the main heap */
+static handle_t *handles;
+static uint32_t handle_cap;
+static uint32_t handle_free;    /* head of the free entries, handle_cap if none */
+
 /* function prototypes for internal helper routines */
 static block_t *extend_heap(size_t words);
+static void *heap_sbrk(size_t incr, size_t *got);
+static void reset_globals(void);
+static int new_heap(void);
+static bool block_ok(block_t *block, block_t *end);
+static size_t pheap_recover(void);
+static void shm_enter(mm_shm_t *shm);
+static void shm_leave(mm_shm_t *shm);
+static void save_ctx(heap_ctx_t *ctx);
+static void load_ctx(const heap_ctx_t *ctx);
 static void place(block_t *block, size_t asize);
 static block_t *find_fit(size_t asize);
 static block_t *coalesce(block_t *block);
@@ -125,6 +476,92 @@ static void removeBlock(block_t *block);
 void mm_checkheap(int verbose);
 static bool endFree();
 static size_t lastSize();
+static size_t adjust_size(size_t size);
+static block_t *find_or_extend(size_t asize);
+static block_t *place_aligned(block_t *block, size_t asize, size_t alignment, size_t offset);
+static void scrub_tags(void *p, size_t n);
+static void zero_payload(void *p, size_t n);
+static size_t align_pad(block_t *block, size_t alignment, size_t offset);
+static block_t *init_seglist(block_t *tp);
+static void use_heap(heap_t *heap);
+static block_t *add_extent(size_t asize);
+static void release_extent(block_t *block);
+static handle_t *handle_entry(mm_handle_t h);
+static site_t *pred_site(void *caller, size_t size);
+static void pred_sample(site_t *site, void *payload);
+static void pred_untrack(void *payload);
+static bool can_slide(block_t *block);
+static block_t *slide_block(block_t *free, block_t *block);
+static size_t purge_block(block_t *block);
+static void prof_sample(void *payload, size_t size);
+static int64_t prof_interval(void);
+static int prof_find(void *payload);
+static bool prof_insert(void *payload, uint32_t site, size_t size);
+static void prof_remove(uint32_t i);
+static void prof_untrack(void *payload);
+static void prof_move(void *from, void *to);
+static int lat_bucket(uint64_t ticks);
+static uint64_t lat_bucket_top(int i);
+static void lat_record(int op, uint64_t ticks);
+static bool grow_in_place(block_t *block, size_t asize);
+static void shrink_block(block_t *block, size_t asize);
+static void grow_track(void *payload, uint32_t growths, size_t size);
+static void grow_forget(void *payload);
+static void run_pressure(size_t bytes);
+static size_t purge_free(void);
+static size_t resident_bytes(uintptr_t lo, uintptr_t hi);
+static void advise_huge(void *lo, void *hi);
+static size_t slab_align(size_t size);
+static void index_add(int list, block_t *block);
+static void free_run(block_t *bp, size_t size);
+static int cmp_addr(const void *a, const void *b);
+static void *quick_pop(size_t asize);
+static void quick_push(void *payload, int c);
+static void drain_free_queue(void);
+static void refill_quick(void);
+static void flush_quick(void);
+static void trim_wilderness(void);
+static void *maint_main(void *arg);
+static void index_remove(int list, block_t *block);
+static int best_fit_scalar(const uint32_t *size, int count, uint32_t asize);
+#if defined(__x86_64__) || defined(__i386__)
+static int best_fit_avx2(const uint32_t *size, int count, uint32_t asize);
+#endif
+
+/* Split size over block_size and size_hi; evaluates size once, unlike a macro */
+static inline void pack(void *p, size_t size, int alloc) {
+    header_t *h = p;
+
+    h->block_size = size & (((size_t)1 << SIZE_LO_BITS) - 1);
+    h->size_hi = size >> SIZE_LO_BITS;
+    h->allocated = alloc;
+}
+
+/* Timestamp for the latency histograms: the TSC where there is one, ns otherwise */
+static inline uint64_t lat_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static inline void pheap_enter(void) {
+    if (pheap != NULL) {
+        pheap->busy++;
+        atomic_signal_fence(memory_order_seq_cst);
+    }
+}
+
+static inline void pheap_leave(void) {
+    if (pheap != NULL) {
+        atomic_signal_fence(memory_order_seq_cst);
+        pheap->busy--;
+    }
+}
 
 static bool endFree() {
     block_t *lastBlock = PREV_BLKP(epilogue);
@@ -133,7 +570,7 @@ static bool endFree() {
 
 static size_t lastSize() {
     block_t *lastBlock = PREV_BLKP(epilogue);
-    return lastBlock->block_size;
+    return GET_SIZE(lastBlock);
 }
 
 int calcList(size_t blockSize) {
@@ -149,26 +586,85 @@ int calcList(size_t blockSize) {
 }
 
 /*
- * mm_init - Initialize the memory manager
+ * adjust_size - Block size for a request of size payload bytes
  */
-/* $begin mminit */
-int mm_init(void) { 
+static size_t adjust_size(size_t size) {
+    size_t asize;
+
+    /* too big for a block: a size no fit or heap growth can satisfy */
+    if (size > MAX_BLOCK_SIZE - OVERHEAD)
+        return SIZE_MAX & ~(size_t)7;
+    size += OVERHEAD;
+    asize = ((size + 7) >> 3) << 3; /* IMPORTANT ALIGNMENT FORMULA: align to multiple of 8 */
+    return MAX(asize, MIN_BLOCK_SIZE);
+}
+
+/*
+ * init_seglist - Lay out the seglist heads at tp, return the block after them
+ */
+static block_t *init_seglist(block_t *tp) {
+    for (int i = 0; i <= LISTMAX; i++) {
+        PACK(tp, MIN_BLOCK_SIZE, ALLOC);
+        SET_NEXT_FREE(tp, NULL);
+        SET_PREV_FREE(tp, NULL);
+        PACK(FTRP(tp), MIN_BLOCK_SIZE, ALLOC);
+        tp = NEXT_BLKP(tp);
+    }
+    return tp;
+}
+
+/*
+ * reset_globals - Forget the state kept outside the heap, it described the old one
+ */
+static void reset_globals(void) {
+    /* forget the sub-heaps, they lived in the old heap */
+    cur_heap = &main_heap;
+    memset(heaps, 0, sizeof(heaps));
+    heaps[0] = &main_heap;
+    for (int i = 0; i < MM_LIFETIME_LONG; i++) {
+        lifetime_heaps[i] = (heap_t){ .id = i + 1 };
+        heaps[i + 1] = &lifetime_heaps[i];
+    }
+    memset(pred_live, 0, sizeof(pred_live));
+    memset(prof_sites, 0, sizeof(prof_sites));
+    memset(prof_live, 0, sizeof(prof_live));
+    prof_live_count = 0;
+    handles = NULL;
+    handle_cap = handle_free = 0;
+    memset(limbo, 0, sizeof(limbo));
+    atomic_store(&free_queue, NULL);
+    memset(quick, 0, sizeof(quick));
+    memset(quick_count, 0, sizeof(quick_count));
+    memset(quick_miss, 0, sizeof(quick_miss));
+    trimmed = NULL;
+    memset(grow, 0, sizeof(grow));
+    grow_live = 0;
+    fit_index = fit_index_mem;
+    memset(fit_index_mem, 0, sizeof(fit_index_mem));
+    best_fit_scan = best_fit_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        best_fit_scan = best_fit_avx2;
+#endif
+}
+
+/*
+ * new_heap - Lay out an empty heap: prologue, seglist heads, one free block and
+ *            the epilogue
+ */
+static int new_heap(void) {
     /* create the initial empty heap */
-    if ((prologue = mem_sbrk(CHUNKSIZE)) == (void*)-1)
+    size_t got;
+
+    if ((prologue = heap_sbrk(CHUNKSIZE, &got)) == (void*)-1)
         return -1;
 
     /* initialize the prologue */
     PACK(prologue, sizeof(header_t), ALLOC);
     
     segList = NEXT_BLKP(prologue);
-    block_t *tp = segList;
-    for (int i = 0; i <= LISTMAX; i++) {
-        PACK(tp, MIN_BLOCK_SIZE, ALLOC);
-        tp->body.next = (void *)0;
-        tp->body.prev = (void *)0;
-        PACK(FTRP(tp), MIN_BLOCK_SIZE, ALLOC);
-        tp = NEXT_BLKP(tp);
-    }
+    block_t *tp = init_seglist(segList);
 
     // /* initialize CHUNKSPACE */
     block_t *init_block = tp;
@@ -179,6 +675,79 @@ int mm_init(void) {
     // /* initialize EPILOGUE */
     epilogue = NEXT_BLKP(init_block);
     PACK(HDRP(epilogue), 0, ALLOC);
+    clean_top = init_block;
+    return 0;
+}
+
+/*
+ * find_or_extend - Find a free block of at least asize bytes, extending the heap
+ *                  if the seglists have none. The block is still on its free list.
+ */
+static block_t *find_or_extend(size_t asize) {
+    block_t *block;
+    size_t extendsize;  /* amount to extend heap if no fit */
+
+    if (asize > MAX_BLOCK_SIZE)
+        return NULL;
+
+    /* Search the free list for a fit */
+    LAT_BEGIN(t);
+    if ((block = find_fit(asize)) != NULL) {
+        LAT_END(MM_LAT_FIT, t);
+        return block;
+    }
+
+    /* Sub-heaps cannot sbrk, they grow by another extent */
+    if (cur_heap != &main_heap) {
+        block = add_extent(asize);
+        LAT_END(MM_LAT_EXTEND, t);
+        return block;
+    }
+
+    /* No fit found. Get more memory; a free last block is merged by extend_heap */
+    extendsize = (endFree() && lastSize() < asize) ? (asize - lastSize()) : (asize);
+    if (huge_pages) {
+        /* end the heap on a huge page boundary, so every page it grows by is whole;
+         * advise before extend_heap writes the tags, or their pages fault in small */
+        void *end = (void *)epilogue + sizeof(header_t);
+        extendsize = (((uintptr_t)end + extendsize + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1)) - (uintptr_t)end;
+        advise_huge(end, end + extendsize);
+    }
+    block = extend_heap(extendsize >> 3); // extendsize/8
+    LAT_END(MM_LAT_EXTEND, t);
+
+    /* Out of memory: let the pressure callbacks free what they can, then retry once.
+     * Not in a shared heap, what they free belongs to the process's own heap. */
+    if (block == NULL && pressure_count > 0 && !in_pressure && (pheap == NULL || !pheap->shared)) {
+        in_pressure = true;
+        run_pressure(asize);
+        block = find_or_extend(asize);
+        in_pressure = false;
+    }
+    return block;
+}
+
+/*
+ * mm_init - Initialize the memory manager
+ */
+/* $begin mminit */
+int mm_init(void) { 
+    void *dirty_top;
+
+    if (pheap != NULL)
+        mm_file_close();
+    reset_globals();
+    heap_base = mem_heap_lo();
+
+    /* memory below the old brk still holds the previous heap after mem_reset_brk */
+    if (brk_base != mem_heap_lo()) {
+        brk_base = mem_heap_lo();
+        brk_max = NULL;
+    }
+    dirty_top = brk_max;
+    if (new_heap() < 0)
+        return -1;
+    clean_top = MAX(dirty_top, clean_top);
     return 0;
 }
 /* $end mminit */
@@ -189,40 +758,48 @@ int mm_init(void) {
 /* $begin mmmalloc */
 void *mm_malloc(size_t size) {
     // printf("begin malloc\n");
-    uint32_t asize;       /* adjusted block size */
-    uint32_t extendsize;  /* amount to extend heap if no fit */
-    uint32_t extendwords; /* number of words to extend heap if no fit */
+    size_t asize;       /* adjusted block size */
     block_t *block;
+    void *payload = NULL;
 
     /* Ignore spurious requests */
     if (size == 0)
         return NULL;
 
     /* Adjust block size to include overhead and alignment reqs. */
-    size += OVERHEAD;
-    asize = ((size + 7) >> 3) << 3; /* IMPORTANT ALIGNMENT FORMULA: align to multiple of 8 */
-    if (asize < MIN_BLOCK_SIZE) {
-        asize = MIN_BLOCK_SIZE;
-    }
-
-    /* Search the free list for a fit */
-    if ((block = find_fit(asize)) != NULL) {
-        place(block, asize);
-        return PLDP(block);
-    }
+    asize = adjust_size(size);
+    if (asize > MAX_BLOCK_SIZE)
+        return NULL;
 
-    /* No fit found. Get more memory and place the block */
-    extendsize = endFree() ? (asize - lastSize()) : (asize);
-    extendwords = extendsize >> 3; // extendsize/8
-    if ((block = extend_heap(extendwords)) != NULL) {
-        // printf("No fit found. Get %d memory and place the block\n", extendsize);
+    LAT_BEGIN(t);
+    HEAP_LOCK();
+    /* Small requests come off the quick lists the maintenance thread fills */
+    if (maint_active && cur_heap == &main_heap && asize <= QUICK_MAX)
+        payload = quick_pop(asize);
+
+    if (payload != NULL) {
+        /* served from a quick list */
+    } else if (cache_coloring && asize >= COLOR_MIN
+               && asize <= MAX_BLOCK_SIZE - COLOR_SPAN - MIN_BLOCK_SIZE) {
+        /* Large payloads start at a rotating line offset so their first lines, which
+         * every stream over them touches together, do not fight over the same sets */
+        size_t offset = color_next * MM_CACHELINE;
+
+        color_next = (color_next + 1) % (COLOR_SPAN / MM_CACHELINE);
+        if ((block = find_or_extend(asize + COLOR_SPAN + MIN_BLOCK_SIZE)) != NULL)
+            payload = PLDP(place_aligned(block, asize, COLOR_SPAN, offset));
+    } else if ((block = find_or_extend(asize)) != NULL) {
+        /* Search the free list for a fit, get more memory if there is none */
         place(block, asize);
-        // mm_checkheap(0);
-        return PLDP(block);
+        payload = PLDP(block);
     }
+    if (payload != NULL)
+        PROF_HOOK(payload, size);
+    HEAP_UNLOCK();
+    LAT_END(MM_LAT_MALLOC, t);
     
-    /* no more memory :( */
-    return NULL;
+    /* NULL: no more memory :( */
+    return payload;
 }
 /* $end mmmalloc */
 
@@ -233,205 +810,1713 @@ void *mm_malloc(size_t size) {
 /* $begin mmfree */
 void mm_free(void *payload) {
     // printf("freeing block\n");
-    /* Free the block first */
     block_t *bp = payload - sizeof(header_t);
-    PACK(HDRP(bp), GET_SIZE(bp), FREE);
-    PACK(FTRP(bp), GET_SIZE(bp), FREE);
-    
-    /* Coalesce */
-    coalesce(bp);
+    LAT_BEGIN(t);
+
+    if (grow_live > 0) {
+        HEAP_LOCK();
+        grow_forget(payload);
+        HEAP_UNLOCK();
+    }
+
+    /* leave the work to the maintenance thread */
+    if (maint_active) {
+        void *head = atomic_load(&free_queue);
+        do {
+            *(void **)payload = head;
+        } while (!atomic_compare_exchange_weak(&free_queue, &head, payload));
+        LAT_END(MM_LAT_FREE, t);
+        return;
+    }
+
+    HEAP_LOCK();
+    if (bp->tracked)
+        pred_untrack(payload);
+    if (bp->sampled)
+        prof_untrack(payload);
+    free_run(bp, GET_SIZE(bp));
+    HEAP_UNLOCK();
+    LAT_END(MM_LAT_FREE, t);
 }
 /* $end mmfree */
 
-
 /*
- * mm_realloc - naive implementation of mm_realloc
- * NO NEED TO CHANGE THIS CODE!
+ * mm_free_batch - Free n blocks at once. The blocks are sorted by address so that
+ *                 runs of neighbours are merged up front and go through coalesce
+ *                 and the seglists once per run instead of once per block.
+ *                 Reorders ptrs.
  */
-void *mm_realloc(void *ptr, size_t size) {
-    void *newp;
-    size_t copySize;
-
-    if ((newp = mm_malloc(size)) == NULL) {
-        printf("ERROR: mm_malloc failed in mm_realloc\n");
-        exit(1);
+/* $begin mmfreebatch */
+void mm_free_batch(void **ptrs, size_t n) {
+    size_t i = 0;
+
+    HEAP_LOCK();
+    qsort(ptrs, n, sizeof(void *), cmp_addr);
+    while (i < n) {
+        block_t *bp = ptrs[i++] - sizeof(header_t);
+        size_t size = GET_SIZE(bp);
+
+        if (grow_live > 0)
+            grow_forget(PLDP(bp));
+        if (bp->tracked)
+            pred_untrack(PLDP(bp));
+        if (bp->sampled)
+            prof_untrack(PLDP(bp));
+        while (i < n && ptrs[i] - sizeof(header_t) == (void *)bp + size) {
+            block_t *next = ptrs[i++] - sizeof(header_t);
+            if (next->heap_id != bp->heap_id) {
+                i--;
+                break;
+            }
+            if (grow_live > 0)
+                grow_forget(PLDP(next));
+            if (next->tracked)
+                pred_untrack(PLDP(next));
+            if (next->sampled)
+                prof_untrack(PLDP(next));
+            size += GET_SIZE(next);
+        }
+        free_run(bp, size);
     }
-    block_t* block = ptr - sizeof(header_t);
-    copySize = block->block_size;
-    if (size < copySize)
-        copySize = size;
-    memcpy(newp, ptr, copySize);
-    mm_free(ptr);
-    return newp;
+    HEAP_UNLOCK();
 }
+/* $end mmfreebatch */
 
+/*
+ * mm_epoch_enter - Start a read-side critical section. Blocks passed to
+ *                  mm_free_deferred stay valid until every thread that was inside
+ *                  one at the time has left it. Safe to call from any thread.
+ *                  Returns -1 if all MAX_READERS reader slots are taken.
+ */
+int mm_epoch_enter(void) {
+    if (reader_slot < 0) {
+        for (int i = 0; i < MAX_READERS && reader_slot < 0; i++) {
+            bool unused = false;
+            if (atomic_compare_exchange_strong(&readers[i].used, &unused, true))
+                reader_slot = i;
+        }
+        if (reader_slot < 0)
+            return -1;
+    }
+    atomic_store(&readers[reader_slot].epoch, atomic_load(&global_epoch) << 1 | 1);
+    return 0;
+}
 
 /*
- * mm_checkheap - Check the heap for consistency
+ * mm_epoch_exit - End the read-side critical section of this thread; a no-op
+ *                 if it never got a reader slot
  */
+void mm_epoch_exit(void) {
+    if (reader_slot < 0)
+        return;
+    atomic_store_explicit(&readers[reader_slot].epoch, 0, memory_order_release);
+}
 
-void mm_checkheap(int verbose) {
-    block_t *bp = prologue;
+/*
+ * mm_free_deferred - Free ptr once no reader can still see it. The block goes into
+ *                    the limbo bag of the current epoch; whole bags are handed to
+ *                    mm_free_batch two epochs later. Allocator thread only.
+ */
+/* $begin mmfreedeferred */
+void mm_free_deferred(void *ptr) {
+    HEAP_LOCK();
+    limbo_t **bag = &limbo[atomic_load(&global_epoch) % 3];
+
+    if (*bag == NULL || (*bag)->count == LIMBO_SLOTS) {
+        limbo_t *fresh = mm_malloc(sizeof(limbo_t));
+        if (fresh == NULL) {
+            printf("ERROR: mm_malloc failed in mm_free_deferred\n");
+            exit(1);
+        }
+        fresh->count = 0;
+        fresh->next = *bag;
+        *bag = fresh;
+    }
+    (*bag)->ptr[(*bag)->count++] = ptr;
 
-    /* Check Prologue */
-    if (verbose)
-        printf("Heap (%p):\n", prologue);
-    if (GET_SIZE(bp) != sizeof(header_t) || !GET_ALLOC(bp))
-        printf("Bad prologue header\n");
-    checkblock(prologue);
+    /* try to move the epoch on whenever a bag chunk fills up */
+    if ((*bag)->count == LIMBO_SLOTS)
+        mm_epoch_reclaim();
+    HEAP_UNLOCK();
+}
+/* $end mmfreedeferred */
 
-    /* Check middle */
-    for (bp = NEXT_BLKP(prologue); GET_SIZE(bp) > 0; bp = NEXT_BLKP(bp)) {
-        if (verbose)
-            printblock(bp);
-        checkblock(bp);
+/*
+ * mm_epoch_reclaim - Advance the global epoch if every active reader has seen the
+ *                    current one, and free the blocks retired two epochs ago.
+ *                    Returns the number of blocks freed.
+ */
+size_t mm_epoch_reclaim(void) {
+    uint64_t epoch = atomic_load(&global_epoch);
+    size_t freed = 0;
+    limbo_t *bag;
+
+    HEAP_LOCK();
+    for (int i = 0; i < MAX_READERS; i++) {
+        uint64_t seen = atomic_load(&readers[i].epoch);
+        if ((seen & 1) && (seen >> 1) != epoch) {
+            HEAP_UNLOCK();
+            return 0;
+        }
     }
-
-    /* Check Epilogue TODO: do not checkblock()*/
-    if (verbose)
-        printblock(bp);
-    if (GET_SIZE(bp) != 0 || !GET_ALLOC(bp))
-        printf("Bad epilogue header, epilogue size = %d, epilogue Allocation status = %d \n", GET_SIZE(bp), GET_ALLOC(bp));
+    atomic_store(&global_epoch, epoch + 1);
+
+    /* the bag the new epoch retires into was filled in epoch - 2 */
+    bag = limbo[(epoch + 1) % 3];
+    limbo[(epoch + 1) % 3] = NULL;
+    while (bag != NULL) {
+        limbo_t *next = bag->next;
+        mm_free_batch(bag->ptr, bag->count);
+        freed += bag->count;
+        mm_free(bag);
+        bag = next;
+    }
+    HEAP_UNLOCK();
+    return freed;
 }
 
-/* The remaining routines are internal helper routines */
 
 /*
- * extend_heap - Extend heap with free block and return its block pointer
+ * mm_memalign - Allocate a block whose payload address is a multiple of alignment.
+ *               alignment must be a power of two; the padding in front of the
+ *               payload is split off as a free block rather than wasted.
  */
-/* $begin mmextendheap */
-static block_t *extend_heap(size_t words) {
-    block_t *newChunkSpace;
-    uint32_t size;
+/* $begin mmmemalign */
+void *mm_memalign(size_t alignment, size_t size) {
+    size_t asize;
+    block_t *block;
 
-    size = words << 3; // words*8
-    if (size == 0 || (newChunkSpace = mem_sbrk(size)) == (void *)-1)
+    if (alignment == 0 || (alignment & (alignment - 1)))
+        return NULL;
+    if (alignment <= DSIZE)
+        return mm_malloc(size);
+    if (size == 0)
+        return NULL;
+    /* too big for a block, and the sum below would wrap */
+    if (size > MAX_BLOCK_SIZE - OVERHEAD || alignment > MAX_BLOCK_SIZE)
         return NULL;
 
-    /* The newly acquired region will start directly after the epilogue block */ 
-    /* Initialize free block header/footer and the new epilogue header */
-    newChunkSpace = (void *)newChunkSpace - sizeof(header_t);   /* use old epilogue as new free block header */
-    PACK(HDRP(newChunkSpace), size, FREE);
-    PACK(FTRP(newChunkSpace), size, FREE);
+    /* Worst case the payload sits just past an alignment boundary and the pad
+     * has to be pushed out to the next one to hold a minimum free block */
+    asize = adjust_size(size);
+    HEAP_LOCK();
+    if ((block = find_or_extend(asize + alignment + MIN_BLOCK_SIZE)) != NULL) {
+        block = place_aligned(block, asize, alignment, 0);
+        PROF_HOOK(PLDP(block), size);
+    }
+    HEAP_UNLOCK();
+    return block ? PLDP(block) : NULL;
+}
+/* $end mmmemalign */
 
-    /* new epilogue header */
-    header_t *new_epilogue = NEXT_BLKP(newChunkSpace);
-    PACK(new_epilogue, 0, ALLOC);
+/*
+ * mm_aligned_alloc - C11 aligned_alloc on top of mm_memalign
+ */
+void *mm_aligned_alloc(size_t alignment, size_t size) {
+    return mm_memalign(alignment, size);
+}
 
-    epilogue = (void *)new_epilogue;
-    
-    /* Coalesce if the previous block was free */
-    return coalesce(newChunkSpace);
+/*
+ * mm_malloc_cacheline - Allocate size bytes on cache lines of their own. For small
+ *                       objects shared across threads: the payload is rounded up to
+ *                       whole lines so no neighbouring block can false-share with it.
+ */
+void *mm_malloc_cacheline(size_t size) {
+    return mm_memalign(MM_CACHELINE, (size + MM_CACHELINE - 1) & ~(size_t)(MM_CACHELINE - 1));
 }
-/* $end mmextendheap */
 
-/* 
- * insertBlock - insert a free block into the free list
+/*
+ * mm_set_cache_coloring - Turn cache coloring of large blocks on or off, return the
+ *                         previous setting
  */
-/* $begin insertBlock */
-static void insertBlock(block_t *block) {
-    
-    uint32_t blockSize = block->block_size;
-    int targetNumber = calcList(blockSize);
-    // printf("inserting block of size: %d into list %d\n", blockSize, targetNumber);
-    block_t *targetNode = (void *)segList + MIN_BLOCK_SIZE * targetNumber;
+int mm_set_cache_coloring(int enable) {
+    int was = cache_coloring;
 
-    block_t *m_root = (void *)(targetNode->body.next);
-    block_t *m_tail = (void *)(targetNode->body.prev);
-    if (m_root != NULL) {
-        m_root->body.prev = (void *)block;
-        block->body.next = (void *)m_root;
-        block->body.prev = NULL;
-        targetNode->body.next = (void *)block;
-        m_tail->body.next = NULL;
-    } else {
-        block->body.prev = NULL;
-        block->body.next = NULL;
-        targetNode->body.next = (void *)block;
-        targetNode->body.prev = (void *)block;
-    }
+    cache_coloring = enable;
+    return was;
 }
 
-/* 
- * removeBlock - remove a free block from the free list
+/*
+ * mm_set_huge_pages - Turn the huge page layout on or off, return the previous
+ *                     setting. Turning it on also advises the heap grown so far.
  */
-/* $begin insertBlock */
-static void removeBlock(block_t *block) {
+int mm_set_huge_pages(int enable) {
+    int was = huge_pages;
+
+    HEAP_LOCK();
+    huge_pages = enable;
+    if (enable && !was)
+        advise_huge(prologue, (void *)epilogue + sizeof(header_t));
+    HEAP_UNLOCK();
+    return was;
+}
 
-    uint32_t blockSize = block->block_size;
-    int targetNumber = calcList(blockSize);
-    block_t *targetNode = (void *)segList + MIN_BLOCK_SIZE * targetNumber;
-    block_t *m_root = (void *)(targetNode->body.next);
-    block_t *m_tail = (void *)(targetNode->body.prev);
-    
-    /* case 1. empty list*/
-    if (m_root == NULL)
-    {
-        if (m_tail != NULL)
-        {
-            printf("FORGOT TO CLEANUP tailptr\n"); 
-            return;
-        }
-        printf("Error: removing block in an empty list\n");
-        return;
+/*
+ * mm_profile_start - Start sampling allocations, one per sample_bytes allocated
+ *                    on average (PROF_PERIOD if 0)
+ */
+void mm_profile_start(size_t sample_bytes) {
+    void *pc[1];
+
+    /* the first backtrace loads the unwinder, do not pay for it in a sample */
+    backtrace(pc, 1);
+    HEAP_LOCK();
+    prof_period = sample_bytes ? sample_bytes : PROF_PERIOD;
+    prof_left = prof_interval();
+    prof_on = true;
+    HEAP_UNLOCK();
+}
+
+/*
+ * mm_profile_stop - Stop sampling. Blocks sampled so far stay in the profile
+ *                   until they are freed.
+ */
+void mm_profile_stop(void) {
+    HEAP_LOCK();
+    prof_on = false;
+    HEAP_UNLOCK();
+}
+
+/*
+ * mm_profile_dump - Write the heap profile to path in the legacy gperftools heap
+ *                   format pprof reads: per call site the live and all-time
+ *                   sampled blocks, then the mappings to symbolize against.
+ *                   Returns 0 on success, -1 if path cannot be written.
+ */
+/* $begin mmprofiledump */
+int mm_profile_dump(const char *path) {
+    size_t objs = 0, bytes = 0, all_objs = 0, all_bytes = 0;
+    char line[512];
+    FILE *f, *maps;
+
+    if ((f = fopen(path, "w")) == NULL) {
+        printf("Error: cannot write heap profile %s\n", path);
+        return -1;
     }
 
-    /* case 2. one-element list */
-    else if (m_root == m_tail)
-    {
-        targetNode->body.next = NULL; 
-        targetNode->body.prev = NULL;
-        block->body.prev = NULL;
-        block->body.next = NULL;
+    HEAP_LOCK();
+    for (int i = 0; i < PROF_SITES; i++) {
+        objs += prof_sites[i].live_count;
+        bytes += prof_sites[i].live_bytes;
+        all_objs += prof_sites[i].alloc_count;
+        all_bytes += prof_sites[i].alloc_bytes;
     }
+    fprintf(f, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+            objs, bytes, all_objs, all_bytes, prof_period);
+    for (int i = 0; i < PROF_SITES; i++) {
+        prof_site_t *site = &prof_sites[i];
+        if (site->hash == 0)
+            continue;
+        fprintf(f, "%zu: %zu [%zu: %zu] @", site->live_count, site->live_bytes,
+                site->alloc_count, site->alloc_bytes);
+        for (int d = 0; d < site->depth; d++)
+            fprintf(f, " %p", site->pc[d]);
+        fprintf(f, "\n");
+    }
+    HEAP_UNLOCK();
 
-    /* case 3. head */
-    else if (block == (void *)m_root)
-    {
-        block_t *succptr = (void *)(block->body.next); //FIXME: succptr is NULL but did not goto case 2
+    fprintf(f, "\nMAPPED_LIBRARIES:\n");
+    if ((maps = fopen("/proc/self/maps", "r")) != NULL) {
+        while (fgets(line, sizeof(line), maps) != NULL)
+            fputs(line, f);
+        fclose(maps);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+/* $end mmprofiledump */
 
-        targetNode->body.next = (void *)(succptr);
-        succptr->body.prev = NULL;
-        block->body.prev = NULL;
-        block->body.next = NULL;
+/*
+ * mm_heap_map - Append a map of the main heap to path, see mm_map_header_t.
+ *               Returns 0 on success, -1 if path cannot be written.
+ */
+/* $begin mmheapmap */
+int mm_heap_map(const char *path) {
+    static unsigned long long seq;
+    mm_map_header_t hdr = {0};
+    uint64_t word[512];
+    size_t n = 0;
+    heap_t *heap = cur_heap;
+    block_t *bp;
+    FILE *f;
+
+    if ((f = fopen(path, "ab")) == NULL) {
+        printf("Error: cannot write heap map %s\n", path);
+        return -1;
     }
 
-    /* case 4. tail */
-    else if (block == (void *)m_tail)
-    {
-        block_t *predptr = (void *)(m_tail->body.prev);
-        targetNode->body.prev = (void *)(predptr);
-        predptr->body.next = NULL;
-        block->body.prev = NULL;
-        block->body.next = NULL;
+    HEAP_LOCK();
+    use_heap(&main_heap);
+    hdr.magic = MM_MAP_MAGIC;
+    hdr.version = MM_MAP_VERSION;
+    hdr.seq = seq++;
+    hdr.first = (void *)prologue - heap_base;
+    hdr.heap_size = (void *)epilogue + sizeof(header_t) - heap_base;
+    for (bp = (void *)prologue; GET_SIZE(bp) > 0; bp = (void *)NEXT_BLKP(bp))
+        hdr.blocks++;
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    for (bp = (void *)prologue; GET_SIZE(bp) > 0; bp = (void *)NEXT_BLKP(bp)) {
+        int state = !GET_ALLOC(bp) ? MM_MAP_FREE : bp->movable ? MM_MAP_MOVABLE : MM_MAP_ALLOC;
+
+        word[n++] = GET_SIZE(bp) | (uint64_t)calcList(GET_SIZE(bp)) << 56 | (uint64_t)state << 60;
+        if (n == sizeof(word) / sizeof(word[0])) {
+            fwrite(word, sizeof(word[0]), n, f);
+            n = 0;
+        }
     }
+    fwrite(word, sizeof(word[0]), n, f);
+    use_heap(heap);
+    HEAP_UNLOCK();
+    return fclose(f) == 0 ? 0 : -1;
+}
+/* $end mmheapmap */
 
-    /* case 5. middle */
-    else 
-    {
-        block_t *predptr = (void *)(block->body.prev);
-        block_t *succptr = (void *)(block->body.next);
+static const char *lat_names[MM_LAT_OPS] = {
+    "malloc", "free", "realloc", "fit", "extend", "split",
+    "coalesce-ATA", "coalesce-FTA", "coalesce-ATF", "coalesce-FTF", "realloc-copy"
+};
 
-        predptr->body.next = (void *)(succptr);
-        succptr->body.prev = (void *)(predptr);
-        block->body.next = NULL;
-        block->body.prev = NULL;
+/*
+ * mm_latency_enable - Start or stop timing the entry points and their paths.
+ *                     The first start measures the tick rate; nothing is
+ *                     printed until mm_latency_report is called. Returns the
+ *                     previous setting.
+ */
+int mm_latency_enable(int enable) {
+    bool was = lat_on;
+
+    if (enable && lat_tick_ns == 0) {
+        struct timespec a, b;
+        uint64_t t0, t1;
+
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        t0 = lat_now();
+        do {
+            clock_gettime(CLOCK_MONOTONIC, &b);
+        } while ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec) < 1e7);
+        t1 = lat_now();
+        lat_tick_ns = ((b.tv_sec - a.tv_sec) * 1e9 + (b.tv_nsec - a.tv_nsec)) / (double)(t1 - t0);
     }
-    // printf("finished removing block of size %d\n", block->block_size);
+    lat_on = enable;
+    return was;
 }
 
+/*
+ * mm_latency_reset - Clear all latency histograms
+ */
+void mm_latency_reset(void) {
+    for (int op = 0; op < MM_LAT_OPS; op++) {
+        for (int i = 0; i < LAT_BUCKETS; i++)
+            atomic_store(&lat_hist[op][i], 0);
+        atomic_store(&lat_count[op], 0);
+        atomic_store(&lat_max[op], 0);
+    }
+}
 
+/*
+ * mm_latency_count - Number of timed runs of op
+ */
+size_t mm_latency_count(int op) {
+    if (op < 0 || op >= MM_LAT_OPS)
+        return 0;
+    return atomic_load(&lat_count[op]);
+}
 
 /*
- * place - Place block of asize bytes at start of free block block
- *         and split if remainder would be at least minimum block size
+ * mm_latency_percentile - Ticks within which pct percent of the timed runs of op
+ *                         finished, to bucket precision; 0 if op never ran
+ */
+unsigned long long mm_latency_percentile(int op, double pct) {
+    uint64_t count, rank, seen = 0;
+
+    if (op < 0 || op >= MM_LAT_OPS || (count = atomic_load(&lat_count[op])) == 0)
+        return 0;
+    rank = (uint64_t)(pct / 100 * count + 0.5);
+    rank = MAX(rank, 1);
+    for (int i = 0; i < LAT_BUCKETS; i++)
+        if ((seen += atomic_load(&lat_hist[op][i])) >= rank)
+            return MIN(lat_bucket_top(i), atomic_load(&lat_max[op]));
+    return atomic_load(&lat_max[op]);
+}
+
+/*
+ * mm_latency_tick_ns - Nanoseconds per tick of the latency histograms
+ */
+double mm_latency_tick_ns(void) {
+    return lat_tick_ns;
+}
+
+/*
+ * mm_latency_report - Print count and percentiles of every op that ran to stderr
+ */
+void mm_latency_report(void) {
+    static const double pcts[] = {50, 90, 99, 99.9};
+
+    fprintf(stderr, "mm latency in ticks, 1 tick = %.3f ns\n", lat_tick_ns);
+    fprintf(stderr, "%-14s %10s %8s %8s %8s %8s %10s\n",
+            "op", "count", "p50", "p90", "p99", "p999", "max");
+    for (int op = 0; op < MM_LAT_OPS; op++) {
+        if (mm_latency_count(op) == 0)
+            continue;
+        fprintf(stderr, "%-14s %10zu", lat_names[op], mm_latency_count(op));
+        for (int i = 0; i < 4; i++)
+            fprintf(stderr, " %8llu", mm_latency_percentile(op, pcts[i]));
+        fprintf(stderr, " %10llu\n", (unsigned long long)atomic_load(&lat_max[op]));
+    }
+}
+
+/*
+ * mm_calloc - Allocate a zeroed array of nmemb elements of size bytes. A block cut
+ *             from never-used heap space is already zero apart from its free list
+ *             links, so only those are cleared.
+ */
+/* $begin mmcalloc */
+void *mm_calloc(size_t nmemb, size_t size) {
+    size_t bytes, asize;
+    bool fresh;
+    block_t *block;
+
+    if (nmemb == 0 || size == 0)
+        return NULL;
+    if (nmemb > SIZE_MAX / size)
+        return NULL;
+    bytes = nmemb * size;
+    asize = adjust_size(bytes);
+
+    HEAP_LOCK();
+    if ((block = find_or_extend(asize)) == NULL) {
+        HEAP_UNLOCK();
+        return NULL;
+    }
+    fresh = (void *)block >= clean_top;
+    place(block, asize);
+    PROF_HOOK(PLDP(block), bytes);
+    HEAP_UNLOCK();
+
+    if (fresh)
+        memset(PLDP(block), 0, sizeof(block->body));
+    else
+        zero_payload(PLDP(block), bytes);
+    return PLDP(block);
+}
+/* $end mmcalloc */
+
+/*
+ * mm_malloc_hint - Allocate size bytes in the sub-heap of a lifetime class, so that
+ *                  short-lived blocks do not leave holes between long-lived ones.
+ *                  MM_LIFETIME_AUTO asks the predictor, which samples the blocks of
+ *                  each call site and size and times how long they live.
+ */
+/* $begin mmmallochint */
+void *mm_malloc_hint(size_t size, int lifetime) {
+    heap_t *heap = cur_heap;
+    site_t *site = NULL;
+    void *payload;
+
+    /* the lifetime classes are sub-heaps, see mm_heap_create */
+    if (pheap != NULL)
+        return mm_malloc(size);
+    HEAP_LOCK();
+    if (lifetime == MM_LIFETIME_AUTO) {
+        site = pred_site(__builtin_return_address(0), size);
+        if (site->samples == 0)
+            lifetime = MM_LIFETIME_DEFAULT;
+        else
+            lifetime = (site->mean < PRED_SHORT) ? MM_LIFETIME_SHORT : MM_LIFETIME_LONG;
+    }
+    if (lifetime < MM_LIFETIME_DEFAULT || lifetime > MM_LIFETIME_LONG) {
+        HEAP_UNLOCK();
+        return NULL;
+    }
+
+    use_heap(heaps[lifetime]);
+    if (lifetime != MM_LIFETIME_DEFAULT && segList == NULL && add_extent(0) == NULL) {
+        use_heap(heap);
+        HEAP_UNLOCK();
+        return NULL;
+    }
+    payload = mm_malloc(size);
+    use_heap(heap);
+
+    if (site != NULL && payload != NULL)
+        pred_sample(site, payload);
+    HEAP_UNLOCK();
+    return payload;
+}
+/* $end mmmallochint */
+
+/*
+ * mm_heap_create - Create an independent heap with its own seglist heads. It grows
+ *                  by extents of the main heap and is torn down as a whole.
+ */
+mm_heap_t *mm_heap_create(void) {
+    heap_t *old = cur_heap;
+    heap_t *heap;
+    int id;
+
+    /* sub-heaps are found through heaps[], which a heap file does not keep */
+    if (pheap != NULL)
+        return NULL;
+    HEAP_LOCK();
+    for (id = MM_LIFETIME_LONG + 1; id < MAX_HEAPS && heaps[id] != NULL; id++)
+        ;
+    if (id == MAX_HEAPS || (heap = mm_malloc(sizeof(heap_t))) == NULL) {
+        HEAP_UNLOCK();
+        return NULL;
+    }
+    *heap = (heap_t){ .id = id };
+    heaps[id] = heap;
+
+    use_heap(heap);
+    if (add_extent(0) == NULL) {
+        use_heap(old);
+        heaps[id] = NULL;
+        mm_free(heap);
+        heap = NULL;
+    }
+    use_heap(old);
+    HEAP_UNLOCK();
+    return heap;
+}
+
+/*
+ * mm_heap_malloc - mm_malloc from heap
+ */
+void *mm_heap_malloc(mm_heap_t *heap, size_t size) {
+    heap_t *old = cur_heap;
+    void *payload;
+
+    HEAP_LOCK();
+    use_heap(heap);
+    payload = mm_malloc(size);
+    use_heap(old);
+    HEAP_UNLOCK();
+    return payload;
+}
+
+/*
+ * mm_heap_free - Free a block of heap. mm_free finds the heap on its own, this
+ *                only checks that the block belongs where the caller thinks.
+ */
+void mm_heap_free(mm_heap_t *heap, void *payload) {
+    block_t *block = payload - sizeof(header_t);
+
+    if (block->heap_id != heap->id) {
+        printf("Error: block %p is not in heap %d\n", block, heap->id);
+        return;
+    }
+    mm_free(payload);
+}
+
+/*
+ * mm_heap_destroy - Free every block of heap by handing its extents back to the
+ *                   main heap: O(#extents), the blocks are never visited
+ */
+void mm_heap_destroy(mm_heap_t *heap) {
+    extent_t *ext;
+
+    HEAP_LOCK();
+    /* queued frees may still point into the extents */
+    if (maint_active)
+        drain_free_queue();
+    /* its blocks stop being blocks, so stop tracking their growth, and forget
+     * those the predictor and the profiler sampled */
+    for (int i = 0; grow_live > 0 && i < GROW_SLOTS; i++) {
+        block_t *block = grow[i].payload - sizeof(header_t);
+
+        if (grow[i].payload != NULL && block->heap_id == heap->id) {
+            grow[i].payload = NULL;
+            grow_live--;
+        }
+    }
+    for (int i = 0; i < PRED_LIVE; i++) {
+        block_t *block = pred_live[i].payload - sizeof(header_t);
+
+        if (pred_live[i].payload != NULL && block->heap_id == heap->id)
+            pred_live[i].payload = NULL;
+    }
+    for (int i = 0; prof_live_count > 0 && i < PROF_LIVE; ) {
+        block_t *block = prof_live[i].payload - sizeof(header_t);
+
+        /* removing shifts the next entry of the probe run into slot i */
+        if (prof_live[i].payload != NULL && block->heap_id == heap->id)
+            prof_untrack(prof_live[i].payload);
+        else
+            i++;
+    }
+    for (ext = heap->extents; ext != NULL; ) {
+        extent_t *next = ext->next;
+        mm_free(ext);
+        ext = next;
+    }
+    heaps[heap->id] = NULL;
+    mm_free(heap);
+    HEAP_UNLOCK();
+}
+
+/*
+ * mm_halloc - Allocate a movable block of size bytes and return a handle to it.
+ *             The block may be moved by mm_compact whenever it is not locked.
+ */
+/* $begin mmhalloc */
+mm_handle_t mm_halloc(size_t size) {
+    void *payload;
+    uint32_t h;
+
+    /* nor does it keep the handle table */
+    if (pheap != NULL)
+        return MM_HANDLE_NULL;
+    HEAP_LOCK();
+    /* grow the table, chaining the new entries onto the free list */
+    if (handle_free == handle_cap) {
+        uint32_t cap = handle_cap ? handle_cap * 2 : HANDLES_INIT;
+        handle_t *table = handles ? mm_realloc(handles, cap * sizeof(handle_t))
+                                  : mm_malloc(cap * sizeof(handle_t));
+        if (table == NULL) {
+            HEAP_UNLOCK();
+            return MM_HANDLE_NULL;
+        }
+        for (h = handle_cap; h < cap; h++) {
+            table[h].payload = NULL;
+            table[h].next_free = h + 1;
+        }
+        handles = table;
+        handle_cap = cap;
+    }
+
+    if ((payload = mm_malloc(size + HANDLE_WORD)) == NULL) {
+        HEAP_UNLOCK();
+        return MM_HANDLE_NULL;
+    }
+    h = handle_free;
+    handle_free = handles[h].next_free;
+    handles[h].payload = payload;
+    handles[h].locks = 0;
+    *(uint64_t *)payload = h;
+    ((block_t *)(payload - sizeof(header_t)))->movable = 1;
+    HEAP_UNLOCK();
+    return h + 1;
+}
+/* $end mmhalloc */
+
+/*
+ * mm_hlock - Pin the block of handle h and return its current address, which
+ *            stays valid until the matching mm_hunlock. Locks nest. Returns
+ *            NULL if h is not a live handle.
+ */
+void *mm_hlock(mm_handle_t h) {
+    handle_t *entry;
+    void *payload = NULL;
+
+    HEAP_LOCK();
+    if ((entry = handle_entry(h)) != NULL) {
+        entry->locks++;
+        payload = entry->payload + HANDLE_WORD;
+    }
+    HEAP_UNLOCK();
+    return payload;
+}
+
+/*
+ * mm_hunlock - Drop one lock of handle h
+ */
+void mm_hunlock(mm_handle_t h) {
+    handle_t *entry;
+
+    HEAP_LOCK();
+    if ((entry = handle_entry(h)) != NULL && entry->locks > 0)
+        entry->locks--;
+    HEAP_UNLOCK();
+}
+
+/*
+ * mm_hfree - Free the block of handle h and the handle itself
+ */
+void mm_hfree(mm_handle_t h) {
+    handle_t *entry;
+
+    HEAP_LOCK();
+    if ((entry = handle_entry(h)) != NULL) {
+        mm_free(entry->payload);
+        entry->payload = NULL;
+        entry->next_free = handle_free;
+        handle_free = h - 1;
+    }
+    HEAP_UNLOCK();
+}
+
+/*
+ * mm_compact - Slide unlocked handle blocks of the main heap down over the free
+ *              blocks in front of them, so free space collects at the end of the
+ *              heap, then give the pages of the trailing free block back to the
+ *              OS. Stops after moving max_bytes (0: no limit) so it can be run in
+ *              slices. Returns the number of bytes moved.
+ */
+/* $begin mmcompact */
+size_t mm_compact(size_t max_bytes) {
+    heap_t *heap = cur_heap;
+    size_t moved = 0;
+    block_t *bp;
+
+    HEAP_LOCK();
+    use_heap(&main_heap);
+    for (bp = NEXT_BLKP(prologue); GET_SIZE(bp) > 0; bp = NEXT_BLKP(bp)) {
+        while (!GET_ALLOC(bp) && can_slide(NEXT_BLKP(bp))) {
+            if (max_bytes && moved >= max_bytes)
+                goto done;
+            moved += GET_SIZE(NEXT_BLKP(bp));
+            bp = slide_block(bp, NEXT_BLKP(bp));
+        }
+    }
+
+done:
+    if (endFree())
+        purge_block(PREV_BLKP(epilogue));
+    use_heap(heap);
+    HEAP_UNLOCK();
+    return moved;
+}
+/* $end mmcompact */
+
+/*
+ * mm_arena_create - Create an arena that bump-allocates out of chunk_size byte
+ *                   chunks (ARENA_CHUNK if 0) obtained from mm_malloc
+ */
+mm_arena_t *mm_arena_create(size_t chunk_size) {
+    mm_arena_t *arena;
+
+    if ((arena = mm_malloc(sizeof(mm_arena_t))) == NULL)
+        return NULL;
+    arena->chunks = NULL;
+    arena->top = NULL;
+    arena->end = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : ARENA_CHUNK;
+    return arena;
+}
+
+/*
+ * mm_arena_alloc - Allocate size bytes from arena. Objects have no header and can
+ *                  only be released all at once by mm_arena_reset/destroy.
+ */
+/* $begin mmarenaalloc */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size) {
+    arena_chunk_t *chunk;
+    void *p;
+
+    size = ((size + 7) >> 3) << 3;
+    if (size == 0)
+        return NULL;
+
+    /* fast path: bump */
+    if (size <= (size_t)(arena->end - arena->top)) {
+        p = arena->top;
+        arena->top += size;
+        return p;
+    }
+
+    /* objects over a quarter chunk get a chunk of their own behind the current
+     * one, so the space left in the current chunk is not thrown away */
+    if (size > arena->chunk_size / 4 && arena->chunks != NULL) {
+        if ((chunk = mm_malloc(sizeof(arena_chunk_t) + size)) == NULL)
+            return NULL;
+        chunk->end = (void *)chunk + sizeof(arena_chunk_t) + size;
+        chunk->next = arena->chunks->next;
+        arena->chunks->next = chunk;
+        return (void *)chunk + sizeof(arena_chunk_t);
+    }
+
+    size_t room = MAX(arena->chunk_size, size);
+    if ((chunk = mm_malloc(sizeof(arena_chunk_t) + room)) == NULL)
+        return NULL;
+    chunk->end = (void *)chunk + sizeof(arena_chunk_t) + room;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->top = (void *)chunk + sizeof(arena_chunk_t) + size;
+    arena->end = chunk->end;
+    return (void *)chunk + sizeof(arena_chunk_t);
+}
+/* $end mmarenaalloc */
+
+/*
+ * mm_arena_reset - Drop every object in arena. Keeps the oldest chunk for reuse
+ *                  and frees the rest: O(#chunks), no per-object work.
+ */
+void mm_arena_reset(mm_arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+
+    if (chunk == NULL)
+        return;
+    while (chunk->next != NULL) {
+        arena_chunk_t *next = chunk->next;
+        mm_free(chunk);
+        chunk = next;
+    }
+    arena->chunks = chunk;
+    arena->top = (void *)chunk + sizeof(arena_chunk_t);
+    arena->end = chunk->end;
+}
+
+/*
+ * mm_arena_destroy - Free every chunk of arena and arena itself
+ */
+void mm_arena_destroy(mm_arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+
+    while (chunk != NULL) {
+        arena_chunk_t *next = chunk->next;
+        mm_free(chunk);
+        chunk = next;
+    }
+    mm_free(arena);
+}
+
+/*
+ * mm_maint_start - Start the maintenance thread. From here on mm_free only queues
+ *                  the block and every other entry point serializes on heap_lock.
+ *                  Returns 0 on success, -1 if the thread cannot be created.
+ */
+/* $begin mmmaint */
+int mm_maint_start(void) {
+    pthread_mutexattr_t attr;
+
+    if (maint_active)
+        return 0;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&heap_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    atomic_store(&maint_stop, false);
+    maint_active = true;
+    if (pthread_create(&maint_thread, NULL, maint_main, NULL) != 0) {
+        maint_active = false;
+        pthread_mutex_destroy(&heap_lock);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * mm_maint_stop - Stop the maintenance thread, then free whatever it left queued
+ *                 or cached on the quick lists
+ */
+void mm_maint_stop(void) {
+    if (!maint_active)
+        return;
+    atomic_store(&maint_stop, true);
+    pthread_join(maint_thread, NULL);
+    maint_active = false;
+    pthread_mutex_destroy(&heap_lock);
+
+    drain_free_queue();
+    flush_quick();
+}
+/* $end mmmaint */
+
+/*
+ * mm_init_from_file - Use the heap in the file at path instead of memlib's,
+ *                     creating it with room for max_size bytes if the file is
+ *                     empty. Reattaching is O(1): links are offsets and the fit
+ *                     index lives in the file. Only if the last process died
+ *                     inside an entry point are the free lists rebuilt.
+ */
+/* $begin mminitfromfile */
+int mm_init_from_file(const char *path, size_t max_size) {
+    struct stat st;
+    pheap_t probe;
+    void *map;
+    int fd;
+    bool fresh;
+
+    if (pheap != NULL)
+        mm_file_close();
+    if ((fd = open(path, O_RDWR | O_CREAT, 0600)) < 0 || fstat(fd, &st) != 0) {
+        printf("Error: cannot open heap file %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    /* a file without its magic is one whose creation never finished */
+    fresh = st.st_size < (off_t)sizeof(pheap_t)
+            || pread(fd, &probe, sizeof(probe), 0) != sizeof(probe) || probe.magic == 0;
+    if (!fresh) {
+        if (probe.magic != PHEAP_MAGIC || probe.version != PHEAP_VERSION
+                || probe.hdr_size != sizeof(pheap_t) || probe.brk > probe.size
+                || probe.brk > (uint64_t)st.st_size) {
+            printf("Error: %s is not a heap file\n", path);
+            close(fd);
+            return -1;
+        }
+        max_size = probe.size;
+    } else {
+        max_size = (MAX(max_size, PHEAP_HDR + CHUNKSIZE) + PHEAP_GROW - 1) & ~(size_t)(PHEAP_GROW - 1);
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, PHEAP_HDR) != 0) {
+            printf("Error: cannot size heap file %s\n", path);
+            close(fd);
+            return -1;
+        }
+        st.st_size = PHEAP_HDR;
+    }
+    if ((map = mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        printf("Error: cannot map heap file %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    reset_globals();
+    pheap = map;
+    pheap_fd = fd;
+    pheap_len = st.st_size;
+    heap_base = map;
+    fit_index = pheap->index;
+
+    if (fresh) {
+        pheap->version = PHEAP_VERSION;
+        pheap->hdr_size = sizeof(pheap_t);
+        pheap->size = max_size;
+        pheap->brk = PHEAP_HDR;
+        if (new_heap() < 0) {
+            mm_file_close();
+            return -1;
+        }
+        atomic_signal_fence(memory_order_seq_cst);
+        pheap->magic = PHEAP_MAGIC;
+        return 0;
+    }
+
+    prologue = heap_base + PHEAP_HDR;
+    segList = NEXT_BLKP(prologue);
+    epilogue = heap_base + pheap->brk - sizeof(header_t);
+    clean_top = heap_base + pheap->brk;     /* the old contents are not zero */
+    if (pheap->busy != 0 || GET_SIZE(epilogue) != 0 || !GET_ALLOC(epilogue)) {
+        size_t lost = pheap_recover();
+        if (lost > 0)
+            printf("Error: heap file %s was damaged, freed %zu bytes\n", path, lost);
+        pheap->busy = 0;
+    }
+    return 0;
+}
+/* $end mminitfromfile */
+
+/*
+ * mm_file_check - Check the heap file: every block parses, free blocks are
+ *                 coalesced and each is on exactly one free list. Returns 0 if
+ *                 it is consistent, -1 otherwise.
+ */
+int mm_file_check(void) {
+    block_t *first, *bp;
+    size_t free_blocks = 0, listed = 0;
+    int bad = 0;
+
+    if (pheap == NULL)
+        return -1;
+    HEAP_LOCK();
+    first = (void *)segList + MIN_BLOCK_SIZE * (LISTMAX + 1);
+    for (bp = first; bp < epilogue; bp = NEXT_BLKP(bp)) {
+        if (!block_ok(bp, epilogue)) {
+            printf("Error: bad block %p in heap file\n", bp);
+            bad = 1;
+            break;
+        }
+        if (!GET_ALLOC(bp)) {
+            free_blocks++;
+            if (!GET_ALLOC(NEXT_BLKP(bp))) {
+                printf("Error: free blocks %p and %p not coalesced\n", bp, NEXT_BLKP(bp));
+                bad = 1;
+            }
+        }
+    }
+
+    for (int i = 0; i <= LISTMAX && !bad; i++) {
+        block_t *head = (void *)segList + MIN_BLOCK_SIZE * i;
+        for (bp = NEXT_FREE(head); bp != NULL && !bad; bp = NEXT_FREE(bp)) {
+            if (bp < first || bp >= epilogue || GET_ALLOC(bp) || ++listed > free_blocks) {
+                printf("Error: bad free list entry %p in list %d\n", bp, i);
+                bad = 1;
+            }
+        }
+    }
+    if (!bad && listed != free_blocks) {
+        printf("Error: %zu free blocks, %zu on the free lists\n", free_blocks, listed);
+        bad = 1;
+    }
+    HEAP_UNLOCK();
+    return bad ? -1 : 0;
+}
+
+/*
+ * mm_file_sync - Write the heap file back to disk. Takes the heap lock without
+ *                entering, so the image on disk is never marked busy.
+ */
+int mm_file_sync(void) {
+    int rc;
+
+    if (pheap == NULL)
+        return -1;
+    if (maint_active)
+        pthread_mutex_lock(&heap_lock);
+    rc = msync(pheap, pheap->brk, MS_SYNC);
+    if (maint_active)
+        pthread_mutex_unlock(&heap_lock);
+    return rc;
+}
+
+/*
+ * mm_file_close - Sync and unmap the heap file. There is no heap afterwards until
+ *                 the next mm_init or mm_init_from_file.
+ */
+void mm_file_close(void) {
+    size_t size;
+
+    if (pheap == NULL)
+        return;
+    mm_maint_stop();
+    size = pheap->size;
+    msync(pheap, pheap->brk, MS_SYNC);
+    munmap(pheap, size);
+    close(pheap_fd);
+    pheap = NULL;
+    heap_base = NULL;
+    prologue = segList = epilogue = NULL;
+    fit_index = fit_index_mem;
+}
+
+/*
+ * mm_file_root, mm_file_set_root - The object a restarted process starts from
+ */
+void *mm_file_root(void) {
+    return (pheap != NULL) ? UNLINK(pheap->root) : NULL;
+}
+
+void mm_file_set_root(void *ptr) {
+    if (pheap != NULL)
+        pheap->root = LINK(ptr);
+}
+
+/*
+ * mm_shm_create - Create the shared heap name (shm_open namespace) of size bytes
+ *                 and map it. Other processes join with mm_shm_attach.
+ */
+/* $begin mmshm */
+mm_shm_t *mm_shm_create(const char *name, size_t size) {
+    pthread_mutexattr_t attr;
+    mm_shm_t *shm;
+    void *map;
+    int fd, laid_out;
+
+    size = (MAX(size, PHEAP_HDR + CHUNKSIZE) + PHEAP_GROW - 1) & ~(size_t)(PHEAP_GROW - 1);
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+        printf("Error: cannot create shared heap %s\n", name);
+        return NULL;
+    }
+    if (ftruncate(fd, size) != 0
+            || (map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        printf("Error: cannot map shared heap %s\n", name);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    if ((shm = mm_malloc(sizeof(mm_shm_t))) == NULL) {
+        munmap(map, size);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    /* the whole region is there from the start, heap_sbrk never lengthens it */
+    shm->ctx = (heap_ctx_t){ .heap_base = map, .pheap = map, .pheap_fd = fd, .pheap_len = size };
+    shm->ctx.fit_index = shm->ctx.pheap->index;
+    shm->ctx.pheap->version = PHEAP_VERSION;
+    shm->ctx.pheap->hdr_size = sizeof(pheap_t);
+    shm->ctx.pheap->size = size;
+    shm->ctx.pheap->brk = PHEAP_HDR;
+    shm->ctx.pheap->shared = 1;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&shm->ctx.pheap->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    HEAP_LOCK();
+    save_ctx(&shm->own);
+    load_ctx(&shm->ctx);
+    laid_out = new_heap();
+    save_ctx(&shm->ctx);
+    load_ctx(&shm->own);
+    HEAP_UNLOCK();
+    if (laid_out < 0) {
+        printf("Error: cannot lay out shared heap %s\n", name);
+        pthread_mutex_destroy(&shm->ctx.pheap->lock);
+        mm_free(shm);
+        munmap(map, size);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    /* attachers wait for the magic */
+    atomic_thread_fence(memory_order_seq_cst);
+    shm->ctx.pheap->magic = PHEAP_MAGIC;
+    return shm;
+}
+
+/*
+ * mm_shm_attach - Map the shared heap name made by mm_shm_create. An attach that
+ *                 races the create waits up to SHM_WAIT_MS for it to finish.
+ */
+mm_shm_t *mm_shm_attach(const char *name) {
+    struct stat st = {0};
+    pheap_t *hdr;
+    mm_shm_t *shm;
+    int fd, waited = 0;
+
+    if ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+        printf("Error: cannot open shared heap %s\n", name);
+        return NULL;
+    }
+    /* the creator sizes the object first and writes the magic last */
+    while (fstat(fd, &st) == 0 && st.st_size == 0 && waited++ < SHM_WAIT_MS)
+        usleep(1000);
+    if (st.st_size == 0
+            || (hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        printf("Error: cannot map shared heap %s\n", name);
+        close(fd);
+        return NULL;
+    }
+    while (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != PHEAP_MAGIC && waited++ < SHM_WAIT_MS)
+        usleep(1000);
+    if (hdr->magic != PHEAP_MAGIC || hdr->version != PHEAP_VERSION || hdr->hdr_size != sizeof(pheap_t)
+            || !hdr->shared || hdr->size != (uint64_t)st.st_size
+            || (shm = mm_malloc(sizeof(mm_shm_t))) == NULL) {
+        printf("Error: %s is not a shared heap\n", name);
+        munmap(hdr, st.st_size);
+        close(fd);
+        return NULL;
+    }
+    shm->ctx = (heap_ctx_t){ .heap_base = hdr, .pheap = hdr, .pheap_fd = fd, .pheap_len = st.st_size };
+    shm->ctx.fit_index = hdr->index;
+    return shm;
+}
+
+/*
+ * mm_shm_malloc - Allocate size bytes from shm. The block can be handed to another
+ *                 process as mm_shm_offset and freed there.
+ */
+void *mm_shm_malloc(mm_shm_t *shm, size_t size) {
+    size_t asize;
+    block_t *block;
+    void *payload = NULL;
+
+    if (size == 0)
+        return NULL;
+    asize = adjust_size(size);
+    shm_enter(shm);
+    if ((block = find_or_extend(asize)) != NULL) {
+        place(block, asize);
+        payload = PLDP(block);
+    }
+    shm_leave(shm);
+    return payload;
+}
+
+/*
+ * mm_shm_free - Free a block of shm, whichever process allocated it
+ */
+void mm_shm_free(mm_shm_t *shm, void *ptr) {
+    block_t *bp = ptr - sizeof(header_t);
+
+    if (ptr == NULL)
+        return;
+    if (ptr < shm->ctx.heap_base + PHEAP_HDR || ptr >= shm->ctx.heap_base + shm->ctx.pheap->brk) {
+        printf("Error: %p is not in shared heap %p\n", ptr, shm->ctx.heap_base);
+        return;
+    }
+    shm_enter(shm);
+    free_run(bp, GET_SIZE(bp));
+    shm_leave(shm);
+}
+
+/*
+ * mm_shm_offset, mm_shm_ptr - Translate between this process's address of a
+ *                             block of shm and the offset other processes use
+ */
+size_t mm_shm_offset(mm_shm_t *shm, void *ptr) {
+    return ptr - shm->ctx.heap_base;
+}
+
+void *mm_shm_ptr(mm_shm_t *shm, size_t offset) {
+    return shm->ctx.heap_base + offset;
+}
+
+/*
+ * mm_shm_detach - Unmap shm from this process; the heap lives on until every
+ *                 process has detached and mm_shm_unlink removed its name
+ */
+void mm_shm_detach(mm_shm_t *shm) {
+    munmap(shm->ctx.heap_base, shm->ctx.pheap->size);
+    close(shm->ctx.pheap_fd);
+    mm_free(shm);
+}
+
+int mm_shm_unlink(const char *name) {
+    return shm_unlink(name);
+}
+/* $end mmshm */
+
+/*
+ * mm_realloc - Resize the block of ptr. A block that has to grow takes the free
+ *              space behind it when it can, else it is moved. One that keeps
+ *              growing gets geometric headroom so the next reallocs fit in
+ *              place; mm_realloc_reclaim takes the headroom back. Returns NULL
+ *              and leaves ptr alone if there is no room.
+ */
+/* $begin mmrealloc */
+void *mm_realloc(void *ptr, size_t size) {
+    void *newp;
+    size_t copySize, asize;
+    block_t* block = ptr - sizeof(header_t);
+    heap_t *heap = cur_heap;
+    uint32_t growths = 0;
+    LAT_BEGIN(t);
+
+    if (ptr == NULL)
+        return mm_malloc(size);
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+
+    asize = adjust_size(size);
+    if (asize > MAX_BLOCK_SIZE)
+        return NULL;
+    HEAP_LOCK();
+    if (GROW_SLOT(ptr)->payload == ptr)
+        growths = GROW_SLOT(ptr)->growths;
+    if (asize <= GET_SIZE(block)) {
+        /* still fits; what is left over stays as headroom, unless it never grew */
+        if (growths > 0)
+            GROW_SLOT(ptr)->size = size;
+        else if (GET_SIZE(block) - asize > 1289) {
+            use_heap(heaps[block->heap_id]);
+            shrink_block(block, asize);
+            use_heap(heap);
+        }
+        HEAP_UNLOCK();
+        LAT_END(MM_LAT_REALLOC, t);
+        return ptr;
+    }
+    /* headroom only while it still fits in a block */
+    if (++growths >= GROW_AFTER && size <= MAX_BLOCK_SIZE - OVERHEAD - MIN(size / 2, GROW_SPARE_MAX))
+        asize = adjust_size(size + MIN(size / 2, GROW_SPARE_MAX));
+
+    /* the new block goes to the heap of the old one */
+    use_heap(heaps[block->heap_id]);
+    if (grow_in_place(block, asize))
+        newp = ptr;
+    else if ((newp = mm_malloc(asize - OVERHEAD)) == NULL)
+        newp = mm_malloc(size);
+    use_heap(heap);
+    /* ptr is left as it was */
+    if (newp == NULL) {
+        HEAP_UNLOCK();
+        LAT_END(MM_LAT_REALLOC, t);
+        return NULL;
+    }
+    grow_track(newp, growths, size);
+    HEAP_UNLOCK();
+    if (newp == ptr) {
+        LAT_END(MM_LAT_REALLOC, t);
+        return ptr;
+    }
+
+    copySize = GET_SIZE(block) - OVERHEAD;
+    if (size < copySize)
+        copySize = size;
+    LAT_BEGIN(copy);
+    memcpy(newp, ptr, copySize);
+    LAT_END(MM_LAT_REALLOC_COPY, copy);
+    mm_free(ptr);
+    LAT_END(MM_LAT_REALLOC, t);
+    return newp;
+}
+/* $end mmrealloc */
+
+/*
+ * mm_realloc_reclaim - Cut every block mm_realloc gave headroom back to the size
+ *                      last asked for; returns the bytes handed back
+ */
+size_t mm_realloc_reclaim(void) {
+    heap_t *heap = cur_heap;
+    size_t freed = 0;
+
+    HEAP_LOCK();
+    for (int i = 0; i < GROW_SLOTS; i++) {
+        block_t *block;
+        size_t size, need;
+
+        if (grow[i].payload == NULL)
+            continue;
+        block = grow[i].payload - sizeof(header_t);
+        /* its heap was destroyed under it */
+        if (heaps[block->heap_id] == NULL)
+            continue;
+        size = GET_SIZE(block);
+        need = adjust_size(grow[i].size);
+        if (size - need < MIN_BLOCK_SIZE)
+            continue;
+        use_heap(heaps[block->heap_id]);
+        shrink_block(block, need);
+        freed += size - need;
+    }
+    use_heap(heap);
+    HEAP_UNLOCK();
+    return freed;
+}
+
+/*
+ * mm_register_pressure_callback - Have fn(bytes, arg) called to free bytes of the
+ *                                 caller's memory when the heap cannot grow, or
+ *                                 when mm_release_free_memory runs short. Returns
+ *                                 0 on success, -1 if every slot is taken.
+ */
+int mm_register_pressure_callback(mm_pressure_fn fn, void *arg) {
+    int ret = 0;
+
+    if (fn == NULL)
+        return -1;
+    HEAP_LOCK();
+    for (int i = 0; i < pressure_count; i++)
+        if (pressure[i].fn == fn && pressure[i].arg == arg)
+            goto done;
+    if (pressure_count == PRESSURE_SLOTS) {
+        ret = -1;
+        goto done;
+    }
+    pressure[pressure_count].fn = fn;
+    pressure[pressure_count].arg = arg;
+    pressure_count++;
+done:
+    HEAP_UNLOCK();
+    return ret;
+}
+
+/*
+ * mm_unregister_pressure_callback - Forget fn with arg; returns -1 if it was not
+ *                                   registered
+ */
+int mm_unregister_pressure_callback(mm_pressure_fn fn, void *arg) {
+    int ret = -1;
+
+    HEAP_LOCK();
+    for (int i = 0; i < pressure_count; i++) {
+        if (pressure[i].fn == fn && pressure[i].arg == arg) {
+            pressure[i] = pressure[--pressure_count];
+            ret = 0;
+            break;
+        }
+    }
+    HEAP_UNLOCK();
+    return ret;
+}
+
+/*
+ * mm_release_free_memory - Give free memory back to the OS until target_bytes of
+ *                          resident pages are released (0: all there is), going
+ *                          one stage further each time the target is not met:
+ *                          1. free the blocks queued or cached by the maintenance
+ *                             thread and retired by mm_free_deferred, which
+ *                             coalesces them, and purge the trailing free block
+ *                          2. cut back the headroom of mm_realloc and purge
+ *                             every free block of every heap
+ *                          3. ask the pressure callbacks and purge again
+ *                          Fills report if not NULL; returns the bytes released.
+ */
+/* $begin mmrelease */
+size_t mm_release_free_memory(size_t target_bytes, mm_release_t *report) {
+    heap_t *heap = cur_heap;
+    struct timespec start, end;
+    size_t released = 0;
+    int stage = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    HEAP_LOCK();
+    while (stage < 3 && (target_bytes == 0 || released < target_bytes)) {
+        switch (++stage) {
+        case 1:
+            drain_free_queue();
+            flush_quick();
+            /* three epochs retire every bag no reader still holds */
+            for (int i = 0; i < 3; i++)
+                mm_epoch_reclaim();
+            use_heap(&main_heap);
+            if (endFree())
+                released += purge_block(PREV_BLKP(epilogue));
+            use_heap(heap);
+            break;
+        case 2:
+            mm_realloc_reclaim();
+            released += purge_free();
+            break;
+        case 3:
+            if (pressure_count == 0 || in_pressure)
+                break;
+            in_pressure = true;
+            run_pressure(target_bytes ? target_bytes - released : 0);
+            in_pressure = false;
+            released += purge_free();
+            break;
+        }
+    }
+    HEAP_UNLOCK();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (report != NULL) {
+        report->target = target_bytes;
+        report->released = released;
+        report->stages = stage;
+        report->ns = (end.tv_sec - start.tv_sec) * 1000000000ull + end.tv_nsec - start.tv_nsec;
+    }
+    return released;
+}
+/* $end mmrelease */
+
+
+/*
+ * mm_checkheap - Check the heap for consistency
+ */
+
+void mm_checkheap(int verbose) {
+    block_t *bp = prologue;
+
+    HEAP_LOCK();
+    /* Check Prologue */
+    if (verbose)
+        printf("Heap (%p):\n", prologue);
+    if (GET_SIZE(bp) != sizeof(header_t) || !GET_ALLOC(bp))
+        printf("Bad prologue header\n");
+    checkblock(prologue);
+
+    /* Check middle */
+    for (bp = NEXT_BLKP(prologue); GET_SIZE(bp) > 0; bp = NEXT_BLKP(bp)) {
+        if (verbose)
+            printblock(bp);
+        checkblock(bp);
+    }
+
+    /* Check Epilogue TODO: do not checkblock()*/
+    if (verbose)
+        printblock(bp);
+    if (GET_SIZE(bp) != 0 || !GET_ALLOC(bp))
+        printf("Bad epilogue header, epilogue size = %zu, epilogue Allocation status = %d \n", GET_SIZE(bp), GET_ALLOC(bp));
+
+    /* Check the extents of the sub-heaps */
+    for (int i = 1; i < MAX_HEAPS; i++) {
+        if (heaps[i] == NULL)
+            continue;
+        for (extent_t *ext = heaps[i]->extents; ext != NULL; ext = ext->next) {
+            if (verbose)
+                printf("Heap %d extent (%p):\n", i, ext);
+            for (bp = (void *)ext + sizeof(extent_t); GET_SIZE(bp) > 0; bp = NEXT_BLKP(bp)) {
+                if (verbose)
+                    printblock(bp);
+                checkblock(bp);
+            }
+            if (!GET_ALLOC(bp))
+                printf("Bad extent epilogue header in heap %d\n", i);
+        }
+    }
+    HEAP_UNLOCK();
+}
+
+/* The remaining routines are internal helper routines */
+
+/*
+ * extend_heap - Extend heap with free block and return its block pointer
+ */
+/* $begin mmextendheap */
+static block_t *extend_heap(size_t words) {
+    block_t *newChunkSpace;
+    size_t size, got;
+
+    size = words << 3; // words*8
+    if (size == 0 || (newChunkSpace = heap_sbrk(size, &got)) == (void *)-1)
+        return NULL;
+
+    /* The newly acquired region will start directly after the epilogue block */ 
+    /* Initialize free block header/footer and the new epilogue header */
+    newChunkSpace = (void *)newChunkSpace - sizeof(header_t);   /* use old epilogue as new free block header */
+    PACK(HDRP(newChunkSpace), got, FREE);
+    PACK(FTRP(newChunkSpace), got, FREE);
+
+    /* new epilogue header */
+    header_t *new_epilogue = NEXT_BLKP(newChunkSpace);
+    PACK(new_epilogue, 0, ALLOC);
+
+    epilogue = (void *)new_epilogue;
+    
+    /* Coalesce if the previous block was free */
+    block_t *block = coalesce(newChunkSpace);
+    if (block != newChunkSpace)
+        scrub_tags(PREV_FTRP(newChunkSpace), OVERHEAD);   /* old last footer + new header */
+
+    /* memlib ran out part way: what it gave stays on the free lists */
+    return got < size ? NULL : block;
+}
+/* $end mmextendheap */
+
+/*
+ * heap_sbrk - mem_sbrk for the active heap: memlib's, or the heap file, which is
+ *             lengthened PHEAP_GROW at a time inside its mapping. Sets got to the
+ *             bytes obtained, which falls short of incr only if memlib ran out
+ *             after the first of several steps; the brk stays moved then.
+ */
+static void *heap_sbrk(size_t incr, size_t *got) {
+    void *p;
+
+    *got = 0;
+    if (pheap == NULL) {
+        /* mem_sbrk takes an int, bigger increments take several calls */
+        void *start = (void *)-1;
+
+        while (incr > 0) {
+            size_t step = MIN(incr, (size_t)INT_MAX & ~(size_t)7);
+            if ((p = mem_sbrk(step)) == (void *)-1)
+                break;
+            if (start == (void *)-1)
+                start = p;
+            *got += step;
+            incr -= step;
+        }
+        brk_max = MAX(brk_max, mem_heap_hi() + 1);
+        return start;
+    }
+
+    if (pheap->brk + incr > pheap->size)
+        return (void *)-1;
+    if (pheap->brk + incr > pheap_len) {
+        size_t len = MIN((pheap->brk + incr + PHEAP_GROW - 1) & ~(size_t)(PHEAP_GROW - 1), pheap->size);
+        if (ftruncate(pheap_fd, len) != 0)
+            return (void *)-1;
+        pheap_len = len;
+    }
+    p = heap_base + pheap->brk;
+    pheap->brk += incr;
+    *got = incr;
+    return p;
+}
+
+/* 
+ * insertBlock - insert a free block into the free list
+ */
+/* $begin insertBlock */
+static void insertBlock(block_t *block) {
+    
+    size_t blockSize = GET_SIZE(block);
+    int targetNumber = calcList(blockSize);
+    // printf("inserting block of size: %d into list %d\n", blockSize, targetNumber);
+    block_t *targetNode = (void *)segList + MIN_BLOCK_SIZE * targetNumber;
+
+    block_t *m_root = NEXT_FREE(targetNode);
+    block_t *m_tail = PREV_FREE(targetNode);
+    if (cur_heap == &main_heap)
+        index_add(targetNumber, block);
+    if (m_root != NULL) {
+        SET_PREV_FREE(m_root, block);
+        SET_NEXT_FREE(block, m_root);
+        SET_PREV_FREE(block, NULL);
+        SET_NEXT_FREE(targetNode, block);
+        SET_NEXT_FREE(m_tail, NULL);
+    } else {
+        SET_PREV_FREE(block, NULL);
+        SET_NEXT_FREE(block, NULL);
+        SET_NEXT_FREE(targetNode, block);
+        SET_PREV_FREE(targetNode, block);
+    }
+}
+
+/* 
+ * removeBlock - remove a free block from the free list
+ */
+/* $begin insertBlock */
+static void removeBlock(block_t *block) {
+
+    size_t blockSize = GET_SIZE(block);
+    int targetNumber = calcList(blockSize);
+    block_t *targetNode = (void *)segList + MIN_BLOCK_SIZE * targetNumber;
+    block_t *m_root = NEXT_FREE(targetNode);
+    block_t *m_tail = PREV_FREE(targetNode);
+    if (cur_heap == &main_heap && m_root != NULL)
+        index_remove(targetNumber, block);
+    
+    /* case 1. empty list*/
+    if (m_root == NULL)
+    {
+        if (m_tail != NULL)
+        {
+            printf("FORGOT TO CLEANUP tailptr\n"); 
+            return;
+        }
+        printf("Error: removing block in an empty list\n");
+        return;
+    }
+
+    /* case 2. one-element list */
+    else if (m_root == m_tail)
+    {
+        SET_NEXT_FREE(targetNode, NULL); 
+        SET_PREV_FREE(targetNode, NULL);
+        SET_PREV_FREE(block, NULL);
+        SET_NEXT_FREE(block, NULL);
+    }
+
+    /* case 3. head */
+    else if (block == (void *)m_root)
+    {
+        block_t *succptr = NEXT_FREE(block); //FIXME: succptr is NULL but did not goto case 2
+
+        SET_NEXT_FREE(targetNode, succptr);
+        SET_PREV_FREE(succptr, NULL);
+        SET_PREV_FREE(block, NULL);
+        SET_NEXT_FREE(block, NULL);
+    }
+
+    /* case 4. tail */
+    else if (block == (void *)m_tail)
+    {
+        block_t *predptr = PREV_FREE(m_tail);
+        SET_PREV_FREE(targetNode, predptr);
+        SET_NEXT_FREE(predptr, NULL);
+        SET_PREV_FREE(block, NULL);
+        SET_NEXT_FREE(block, NULL);
+    }
+
+    /* case 5. middle */
+    else 
+    {
+        block_t *predptr = PREV_FREE(block);
+        block_t *succptr = NEXT_FREE(block);
+
+        SET_NEXT_FREE(predptr, succptr);
+        SET_PREV_FREE(succptr, predptr);
+        SET_NEXT_FREE(block, NULL);
+        SET_PREV_FREE(block, NULL);
+    }
+    // printf("finished removing block of size %d\n", block->block_size);
+}
+
+
+
+/*
+ * place - Place block of asize bytes at start of free block block
+ *         and split if remainder would be at least minimum block size
  */
 /* $begin mmplace */
 static void place(block_t *block, size_t asize) {
 
     // printf("Placing block: original block of size %d", block->block_size);
 
-    uint32_t split_size = GET_SIZE(block) - asize;
+    size_t split_size = GET_SIZE(block) - asize;
+    LAT_BEGIN(t);
     removeBlock(block);
     if (split_size <= 1289) {
         // printf("placing block: WHOLE\n");
@@ -441,132 +2526,636 @@ static void place(block_t *block, size_t asize) {
 
     else {
         // printf("placing block OF SIZE %lu: SPLIT\n", asize);
-        block->block_size = asize;
-        block->allocated = ALLOC;
+        PACK(HDRP(block), asize, ALLOC);
         footer_t *m_footer = get_footer(block);
-        m_footer->block_size = asize;
-        m_footer->allocated = ALLOC;
+        PACK(m_footer, asize, ALLOC);
 
         block_t *splitBlock = (void *)(NEXT_BLKP(block));
-        splitBlock->block_size = split_size;
-        splitBlock->allocated = FREE;
+        PACK(HDRP(splitBlock), split_size, FREE);
         footer_t *splitBlock_footer = get_footer(splitBlock);
-        splitBlock_footer->block_size = split_size;
-        splitBlock_footer->allocated = FREE;
+        PACK(splitBlock_footer, split_size, FREE);
         insertBlock(splitBlock);
+        LAT_END(MM_LAT_SPLIT, t);
+    }
+
+    block->heap_id = cur_heap->id;
+    block->tracked = 0;
+    block->movable = 0;
+    block->sampled = 0;
+    alloc_clock++;
+
+    /* the user owns the block now, it is no longer clean */
+    if (NEXT_BLKP(block) > clean_top)
+        clean_top = NEXT_BLKP(block);
+
+    /* TODO: delete when finished developing */
+    // mm_checkheap(0);
+}
+/* $end mmplace */
+
+/*
+ * align_pad - Bytes to skip from the start of free block block so that the payload
+ *             behind it sits offset bytes past a multiple of alignment: zero, or a
+ *             pad big enough to be a free block
+ */
+static size_t align_pad(block_t *block, size_t alignment, size_t offset) {
+    size_t pad = (offset - (uintptr_t)PLDP(block)) & (alignment - 1);
+
+    if (pad > 0 && pad < MIN_BLOCK_SIZE)
+        pad += (MIN_BLOCK_SIZE - pad + alignment - 1) & ~(alignment - 1);
+    return pad;
+}
+
+/*
+ * place_aligned - Place block of asize bytes in free block block so that its payload
+ *                 is offset bytes past a multiple of alignment; the leading pad goes
+ *                 back onto the seglists. Returns the placed block.
+ */
+static block_t *place_aligned(block_t *block, size_t asize, size_t alignment, size_t offset) {
+    size_t pad = align_pad(block, alignment, offset);
+
+    if (pad > 0) {
+        size_t rest_size = GET_SIZE(block) - pad;
+        block_t *rest = (void *)block + pad;
+
+        /* the block's predecessor is allocated, so the pad needs no coalescing */
+        removeBlock(block);
+        PACK(HDRP(block), pad, FREE);
+        PACK(FTRP(block), pad, FREE);
+        insertBlock(block);
+
+        PACK(HDRP(rest), rest_size, FREE);
+        PACK(FTRP(rest), rest_size, FREE);
+        insertBlock(rest);
+        block = rest;
+    }
+    place(block, asize);
+    return block;
+}
+
+/*
+ * find_fit - Find a fit for a block with asize bytes. Main-heap lists are searched
+ *            best fit through their side index first; the list itself is only
+ *            walked, first fit, when it holds blocks the index does not.
+ */
+static block_t *find_fit(size_t asize) {
+    size_t blockSize = asize;
+    int targetNumber = calcList(blockSize);
+    ;
+    for (int i = targetNumber; i <= LISTMAX; i++)
+    {
+        if (cur_heap == &main_heap) {
+            fit_index_t *index = &fit_index[i];
+            int slot = (asize <= UINT32_MAX) ? best_fit_scan(index->size, index->count, asize) : -1;
+            if (slot >= 0)
+                return (void *)prologue + index->off[slot];
+            if (index->unindexed == 0)
+                continue;
+        }
+
+        /* first fit search */
+        block_t *targetNode = (void *)segList + MIN_BLOCK_SIZE * i;
+        block_t *m_root = PREV_FREE(targetNode);
+        int count = 0;
+        while (m_root != NULL && count <= 12)
+        {
+            if (GET_SIZE(m_root) >= asize)
+            {
+                // printf("found fit at target = %d\n", i);
+                return m_root;
+            }
+            m_root = PREV_FREE(m_root);
+            count++;
+        }
+    }
+
+    // printf("failed to find fit for block\n");
+    return NULL; /* no fit */
+}
+
+/*
+ * index_add - Record free block block of seglist list in the side index
+ */
+static void index_add(int list, block_t *block) {
+    fit_index_t *index = &fit_index[list];
+
+    /* the slots are 32 bits, bigger blocks and offsets are only on the list */
+    if (index->count == FIT_SLOTS || GET_SIZE(block) > UINT32_MAX
+            || (uintptr_t)((void *)block - (void *)prologue) > UINT32_MAX) {
+        index->unindexed++;
+        return;
+    }
+    index->size[index->count] = GET_SIZE(block);
+    index->off[index->count] = (void *)block - (void *)prologue;
+    index->count++;
+}
+
+/*
+ * index_remove - Drop block from the side index of seglist list, moving the last
+ *                slot into its place
+ */
+static void index_remove(int list, block_t *block) {
+    fit_index_t *index = &fit_index[list];
+    uint64_t off = (void *)block - (void *)prologue;
+
+    for (int i = 0; i < index->count; i++) {
+        if (index->off[i] == off) {
+            index->count--;
+            index->size[i] = index->size[index->count];
+            index->off[i] = index->off[index->count];
+            index->size[index->count] = 0;
+            return;
+        }
+    }
+    index->unindexed--;
+}
+
+/*
+ * best_fit_scalar - Slot of the smallest size >= asize among count sizes, -1 if none
+ */
+static int best_fit_scalar(const uint32_t *size, int count, uint32_t asize) {
+    int best = -1;
+
+    for (int i = 0; i < count; i++)
+        if (size[i] >= asize && (best < 0 || size[i] < size[best]))
+            best = i;
+    return best;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * best_fit_avx2 - best_fit_scalar eight slots at a time. Sizes below asize are
+ *                 masked to UINT32_MAX and an unsigned min keeps the best per lane.
+ */
+__attribute__((target("avx2")))
+static int best_fit_avx2(const uint32_t *size, int count, uint32_t asize) {
+    __m256i need = _mm256_set1_epi32(asize);
+    __m256i none = _mm256_set1_epi32(-1);
+    __m256i best = none;
+    int vecs = (count + 7) >> 3;
+    uint32_t lane[8], min;
+
+    for (int i = 0; i < vecs; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)size + i);
+        __m256i fits = _mm256_cmpeq_epi32(_mm256_max_epu32(v, need), v);
+        best = _mm256_min_epu32(best, _mm256_blendv_epi8(none, v, fits));
+    }
+
+    /* horizontal min, then the first slot holding it */
+    best = _mm256_min_epu32(best, _mm256_shuffle_epi32(best, _MM_SHUFFLE(1, 0, 3, 2)));
+    best = _mm256_min_epu32(best, _mm256_shuffle_epi32(best, _MM_SHUFFLE(2, 3, 0, 1)));
+    _mm256_storeu_si256((__m256i *)lane, best);
+    min = MIN(lane[0], lane[4]);
+    if (min == UINT32_MAX)
+        return -1;
+
+    need = _mm256_set1_epi32(min);
+    for (int i = 0; i < vecs; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)size + i);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, need)));
+        if (mask)
+            return (i << 3) + __builtin_ctz(mask);
+    }
+    return -1;
+}
+#endif
+
+/*
+ * coalesce - boundary tag coalescing. Return ptr to coalesced block
+ */
+static block_t *coalesce(block_t *block) {
+    // printf("coalescing - ");
+
+    //FIXME: problem: overwriting the seglist's pointers
+    bool prev_alloc = GET_ALLOC(PREV_BLKP(block));
+    bool next_alloc = GET_ALLOC(NEXT_BLKP(block));
+    size_t size = GET_SIZE(block);
+    LAT_BEGIN(t);
+
+    /* case I: A | T | A */
+    if (prev_alloc && next_alloc)
+    {
+        // printf("ATA\n");
+        insertBlock(block);
+        LAT_END(MM_LAT_COALESCE_ATA, t);
+        return block;
+    }
+
+    else if (!prev_alloc && next_alloc) {
+        // printf("FTA\n");
+        //merge prevBlk + currBlk
+        block_t *prevblk = (void *)PREV_BLKP(block);
+        removeBlock(prevblk);
+
+        size += GET_SIZE(prevblk);
+        PACK(FTRP(block), size, FREE);
+        PACK(prevblk, size, FREE);  //FIXME: these may invoke seg fault because we rewrote the blocks
+
+        insertBlock(prevblk);
+        LAT_END(MM_LAT_COALESCE_FTA, t);
+        return prevblk;
+    }    
+
+    /* case II: A | T | F */
+    else if (prev_alloc && !next_alloc)
+    {
+        // printf("ATF\n");
+        //merge currBlk + nextBlk
+        block_t *nextBlk = (void *)NEXT_BLKP(block);
+        removeBlock(nextBlk);
+        size += GET_SIZE(nextBlk);
+        scrub_tags(nextBlk, sizeof(header_t) + sizeof(nextBlk->body));
+
+        PACK(HDRP(block), size, FREE);
+        PACK(FTRP(block), size, FREE);
+        insertBlock(block);
+        LAT_END(MM_LAT_COALESCE_ATF, t);
+        return block;
+    }
+
+    /* case IV: F | T | F */
+    else {
+        // printf("FTF\n");
+        block_t *prevblk = (void *)PREV_BLKP(block);
+        block_t *nextblk = (void *)NEXT_BLKP(block);
+        
+        removeBlock(nextblk);
+        removeBlock(prevblk);
+        size += (GET_SIZE(prevblk) + GET_SIZE(nextblk));
+        
+        PACK(FTRP(nextblk), size, FREE);
+        PACK(prevblk, size, FREE);
+        /* after FTRP, which needs the size the scrub may clear */
+        scrub_tags(nextblk, sizeof(header_t) + sizeof(nextblk->body));
+        insertBlock(prevblk);
+        LAT_END(MM_LAT_COALESCE_FTF, t);
+        return prevblk;
+    }
+}
+
+/*
+ * free_run - Free the size bytes of allocated blocks starting at bp, all of one
+ *            heap, as a single block
+ */
+static void free_run(block_t *bp, size_t size) {
+    heap_t *heap = cur_heap;
+
+    use_heap(heaps[bp->heap_id]);
+
+    /* Free the block first */
+    PACK(HDRP(bp), size, FREE);
+    PACK(FTRP(bp), size, FREE);
+    
+    /* Coalesce */
+    bp = coalesce(bp);
+
+    /* Hand a sub-heap extent that became empty back to the main heap */
+    if (cur_heap != &main_heap && GET_SIZE(PREV_BLKP(bp)) == sizeof(header_t)
+            && GET_SIZE(NEXT_BLKP(bp)) == 0)
+        release_extent(bp);
+    use_heap(heap);
+}
+
+/*
+ * cmp_addr - qsort order of pointers by address
+ */
+static int cmp_addr(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * use_heap - Make heap the one the globals and the list routines work on
+ */
+static void use_heap(heap_t *heap) {
+    if (heap == cur_heap)
+        return;
+    cur_heap->prologue = prologue;
+    cur_heap->segList = segList;
+    cur_heap->epilogue = epilogue;
+    prologue = heap->prologue;
+    segList = heap->segList;
+    epilogue = heap->epilogue;
+    cur_heap = heap;
+}
+
+/*
+ * add_extent - Grow the active sub-heap by an extent from the main heap holding a
+ *              free block of at least asize bytes. The first extent also gets the
+ *              seglist heads. Returns the free block, already on its list.
+ */
+static block_t *add_extent(size_t asize) {
+    heap_t *heap = cur_heap;
+    size_t lists = (segList == NULL) ? MIN_BLOCK_SIZE * (LISTMAX + 1) : 0;
+    size_t want = MAX(asize + lists + EXTENT_OVERHEAD, EXTENT_SIZE);
+    size_t align = slab_align(want);
+    extent_t *ext;
+    block_t *block;
+    void *end;
+
+    use_heap(&main_heap);
+    ext = align ? mm_memalign(align, want) : mm_malloc(want);
+    use_heap(heap);
+    if (ext == NULL)
+        return NULL;
+
+    ext->prev = NULL;
+    ext->next = heap->extents;
+    if (ext->next != NULL)
+        ext->next->prev = ext;
+    heap->extents = ext;
+
+    /* extent prologue, then the seglist heads if this is the first extent */
+    block = (void *)ext + sizeof(extent_t);
+    PACK(block, sizeof(header_t), ALLOC);
+    if (lists) {
+        prologue = block;
+        segList = NEXT_BLKP(block);
+        block = init_seglist(segList);
+    } else {
+        block = NEXT_BLKP(block);
+    }
+
+    /* the rest of the host block is one free block and the extent epilogue; an
+     * aligned extent stops at want so it stays inside its huge page */
+    end = (void *)ext + GET_SIZE(HDRP((void *)ext - sizeof(header_t))) - OVERHEAD;
+    if (align)
+        end = MIN(end, (void *)ext + want);
+    size_t size = end - sizeof(header_t) - (void *)block;
+    PACK(HDRP(block), size, FREE);
+    PACK(FTRP(block), size, FREE);
+    PACK(HDRP(NEXT_BLKP(block)), 0, ALLOC);
+    if (lists)
+        epilogue = NEXT_BLKP(block);
+    insertBlock(block);
+    return block;
+}
+
+/*
+ * release_extent - Give the extent that free block block spans back to the main heap
+ */
+static void release_extent(block_t *block) {
+    heap_t *heap = cur_heap;
+    extent_t *ext = (void *)PREV_BLKP(block) - sizeof(extent_t);
+
+    removeBlock(block);
+    if (ext->prev != NULL)
+        ext->prev->next = ext->next;
+    else
+        heap->extents = ext->next;
+    if (ext->next != NULL)
+        ext->next->prev = ext->prev;
+
+    use_heap(&main_heap);
+    mm_free(ext);
+    use_heap(heap);
+}
+
+/*
+ * pred_site - Predictor slot of a call site and request size. Slots are direct
+ *             mapped; a colliding site simply starts over.
+ */
+static site_t *pred_site(void *caller, size_t size) {
+    uintptr_t key = (uintptr_t)caller ^ (uintptr_t)(63 - __builtin_clzl(size | 1));
+    site_t *site = PRED_SLOT(key);
+
+    if (site->key != key) {
+        memset(site, 0, sizeof(site_t));
+        site->key = key;
+    }
+    return site;
+}
+
+/*
+ * pred_sample - Count an allocation of site and time one in PRED_PERIOD of them
+ */
+static void pred_sample(site_t *site, void *payload) {
+    block_t *block = payload - sizeof(header_t);
+
+    if (site->count++ % PRED_PERIOD)
+        return;
+    for (int i = 0; i < PRED_LIVE; i++) {
+        if (pred_live[i].payload == NULL) {
+            pred_live[i].payload = payload;
+            pred_live[i].key = site->key;
+            pred_live[i].born = alloc_clock;
+            block->tracked = 1;
+            return;
+        }
+    }
+}
+
+/*
+ * pred_untrack - A sampled block died, fold its lifetime into its site
+ */
+static void pred_untrack(void *payload) {
+    for (int i = 0; i < PRED_LIVE; i++) {
+        if (pred_live[i].payload != payload)
+            continue;
+        uintptr_t key = pred_live[i].key;
+        site_t *site = PRED_SLOT(key);
+        uint64_t lifetime = alloc_clock - pred_live[i].born;
+
+        if (site->key == key) {
+            site->mean = site->samples ? (site->mean * 3 + lifetime) / 4 : lifetime;
+            site->samples++;
+        }
+        pred_live[i].payload = NULL;
+        return;
     }
+}
+
+/*
+ * handle_entry - Table entry of live handle h, NULL for MM_HANDLE_NULL, a handle
+ *                out of range or one already freed
+ */
+static handle_t *handle_entry(mm_handle_t h) {
+    if (h == MM_HANDLE_NULL || h > handle_cap || handles[h - 1].payload == NULL)
+        return NULL;
+    return &handles[h - 1];
+}
+
+/*
+ * can_slide - Is block an unlocked handle block? Prologue, seglist heads and the
+ *             epilogue never had their spare header bits set, so check the table too.
+ */
+static bool can_slide(block_t *block) {
+    uint64_t h;
+
+    if (GET_SIZE(block) == 0 || !GET_ALLOC(block) || !block->movable)
+        return false;
+    h = *(uint64_t *)PLDP(block);
+    return h < handle_cap && handles[h].payload == PLDP(block) && handles[h].locks == 0;
+}
+
+/*
+ * slide_block - Move handle block block down into the free block right before it.
+ *               Returns the free block that now follows it, coalesced.
+ */
+static block_t *slide_block(block_t *free, block_t *block) {
+    size_t fsize = GET_SIZE(free);
+    handle_t *handle = &handles[*(uint64_t *)PLDP(block)];
+
+    removeBlock(free);
+    if (block->sampled)
+        prof_move(PLDP(block), PLDP(free));
+    memmove(free, block, GET_SIZE(block));
+    handle->payload = PLDP(free);
+
+    block = NEXT_BLKP(free);
+    PACK(HDRP(block), fsize, FREE);
+    PACK(FTRP(block), fsize, FREE);
+    return coalesce(block);
+}
+
+/*
+ * purge_block - Give the whole pages inside free block block back to the OS. The
+ *               header, links and footer stay; the pages read back as zero.
+ *               Returns the bytes of those pages that were resident.
+ */
+static size_t purge_block(block_t *block) {
+    /* with huge pages only whole ones go, a partial purge would split them */
+    uintptr_t page = huge_pages ? HUGE_PAGE : (uintptr_t)mem_pagesize();
+    uintptr_t lo = ((uintptr_t)PLDP(block) + sizeof(block->body) + page - 1) & ~(page - 1);
+    uintptr_t hi = (uintptr_t)FTRP(block) & ~(page - 1);
+    size_t resident;
+
+    if (hi <= lo)
+        return 0;
+    resident = resident_bytes(lo, hi);
+
+    /* dropping pages of a shared file mapping keeps their data, punch a hole */
+    if (madvise((void *)lo, hi - lo, pheap ? MADV_REMOVE : MADV_DONTNEED) != 0)
+        return 0;
+    return resident;
+}
 
-    /* TODO: delete when finished developing */
-    // mm_checkheap(0);
+/*
+ * resident_bytes - Bytes of the pages in [lo, hi) that are in memory, all of them
+ *                  if mincore cannot tell
+ */
+static size_t resident_bytes(uintptr_t lo, uintptr_t hi) {
+    size_t page = mem_pagesize();
+    unsigned char vec[MINCORE_PAGES];
+    size_t bytes = 0;
+
+    for (; lo < hi; lo += MINCORE_PAGES * page) {
+        size_t n = MIN((hi - lo) / page, MINCORE_PAGES);
+
+        if (mincore((void *)lo, n * page, vec) != 0)
+            return bytes + (hi - lo);
+        for (size_t i = 0; i < n; i++)
+            bytes += (vec[i] & 1) * page;
+    }
+    return bytes;
 }
-/* $end mmplace */
 
-//TODO: try to employ best-fit search
 /*
- * find_fit - Find a fit for a block with asize bytes
+ * purge_free - Purge every free block of every heap, returns the bytes released
  */
-static block_t *find_fit(size_t asize) {
-    /* first fit search */
-    uint32_t blockSize = asize;
-    int targetNumber = calcList(blockSize);
-    ;
-    for (int i = targetNumber; i <= LISTMAX; i++)
-    {
-        block_t *targetNode = (void *)segList + MIN_BLOCK_SIZE * i;
-        block_t *m_root = (void *)(targetNode->body.prev);
-        int count = 0;
-        while (m_root != NULL && count <= 12)
-        {
-            if (GET_SIZE(m_root) >= asize)
-            {
-                // printf("found fit at target = %d\n", i);
-                return m_root;
-            }
-            m_root = (void *)(m_root->body.prev);
-            count++;
+static size_t purge_free(void) {
+    heap_t *heap = cur_heap;
+    size_t released = 0;
+
+    for (int h = 0; h < MAX_HEAPS; h++) {
+        if (heaps[h] == NULL)
+            continue;
+        use_heap(heaps[h]);
+        for (int i = 0; i <= LISTMAX && segList != NULL; i++) {
+            block_t *head = (void *)segList + MIN_BLOCK_SIZE * i;
+            for (block_t *bp = NEXT_FREE(head); bp != NULL; bp = NEXT_FREE(bp))
+                released += purge_block(bp);
         }
     }
-
-    // printf("failed to find fit for block\n");
-    return NULL; /* no fit */
+    use_heap(heap);
+    return released;
 }
 
 /*
- * coalesce - boundary tag coalescing. Return ptr to coalesced block
+ * run_pressure - Ask every pressure callback to free bytes (0: all it can spare),
+ *                then free what they and the maintenance thread hold
  */
-static block_t *coalesce(block_t *block) {
-    // printf("coalescing - ");
-
-    //FIXME: problem: overwriting the seglist's pointers
-    bool prev_alloc = GET_ALLOC(PREV_BLKP(block));
-    bool next_alloc = GET_ALLOC(NEXT_BLKP(block));
-    size_t size = GET_SIZE(block);
-
-    /* case I: A | T | A */
-    if (prev_alloc && next_alloc)
-    {
-        // printf("ATA\n");
-        insertBlock(block);
-        return block;
-    }
+static void run_pressure(size_t bytes) {
+    for (int i = 0; i < pressure_count; i++)
+        pressure[i].fn(bytes, pressure[i].arg);
+    drain_free_queue();
+    flush_quick();
+}
 
-    else if (!prev_alloc && next_alloc) {
-        // printf("FTA\n");
-        //merge prevBlk + currBlk
-        block_t *prevblk = (void *)PREV_BLKP(block);
-        removeBlock(prevblk);
+/*
+ * advise_huge - Ask for transparent huge pages over [lo, hi). The kernel only
+ *               backs the HUGE_PAGE aligned parts with them.
+ */
+static void advise_huge(void *lo, void *hi) {
+#ifdef MADV_HUGEPAGE
+    uintptr_t start = (uintptr_t)lo & ~((uintptr_t)mem_pagesize() - 1);
 
-        size += GET_SIZE(prevblk);
-        PACK(FTRP(block), size, FREE);
-        PACK(prevblk, size, FREE);  //FIXME: these may invoke seg fault because we rewrote the blocks
+    if ((uintptr_t)hi > start)
+        madvise((void *)start, (uintptr_t)hi - start, MADV_HUGEPAGE);
+#endif
+}
 
-        insertBlock(prevblk);
-        return prevblk;
-    }    
+/*
+ * slab_align - Alignment that keeps a slab of size bytes inside one huge page,
+ *              the power of two at or above size; 0 if there is no need
+ */
+static size_t slab_align(size_t size) {
+    size_t align = MIN_BLOCK_SIZE;
+
+    if (!huge_pages || size > HUGE_PAGE)
+        return 0;
+    while (align < size)
+        align <<= 1;
+    return align;
+}
 
-    /* case II: A | T | F */
-    else if (prev_alloc && !next_alloc)
-    {
-        // printf("ATF\n");
-        //merge currBlk + nextBlk
-        block_t *nextBlk = (void *)NEXT_BLKP(block);
-        removeBlock(nextBlk);
-        
-        size += GET_SIZE(nextBlk);
-        PACK(HDRP(block), size, FREE);
-        PACK(FTRP(block), size, FREE);
-        insertBlock(block);
-        return block;
-    }
+/*
+ * scrub_tags - Zero the part of a dead header/footer/link range at p that lies in
+ *              clean heap space, so mm_calloc can keep trusting it
+ */
+static void scrub_tags(void *p, size_t n) {
+    if (p + n > clean_top)
+        memset(MAX(p, clean_top), 0, p + n - MAX(p, clean_top));
+}
 
-    /* case IV: F | T | F */
-    else {
-        // printf("FTF\n");
-        block_t *prevblk = (void *)PREV_BLKP(block);
-        block_t *nextblk = (void *)NEXT_BLKP(block);
-        
-        removeBlock(nextblk);
-        removeBlock(prevblk);
-        size += (GET_SIZE(prevblk) + GET_SIZE(nextblk));
-        
-        PACK(FTRP(nextblk), size, FREE);
-        PACK(prevblk, size, FREE);
-        insertBlock(prevblk);
-        return prevblk;
+/*
+ * zero_payload - memset for calloc; big payloads are cleared with non-temporal
+ *                stores so they do not flush the cache
+ */
+static void zero_payload(void *p, size_t n) {
+#ifdef __SSE2__
+    if (n >= NT_ZERO_MIN) {
+        size_t head = -(uintptr_t)p & 15;
+        __m128i zero = _mm_setzero_si128();
+
+        memset(p, 0, head);
+        p += head;
+        n -= head;
+        for (; n >= 64; p += 64, n -= 64) {
+            _mm_stream_si128((__m128i *)p, zero);
+            _mm_stream_si128((__m128i *)p + 1, zero);
+            _mm_stream_si128((__m128i *)p + 2, zero);
+            _mm_stream_si128((__m128i *)p + 3, zero);
+        }
+        _mm_sfence();
     }
+#endif
+    memset(p, 0, n);
 }
 
 static footer_t* get_footer(block_t *block) {
-    return (void*)block + block->block_size - sizeof(footer_t);
+    return (void*)block + GET_SIZE(block) - sizeof(footer_t);
 }
 
 static void printblock(block_t *block) {
-    uint32_t hsize, halloc, fsize, falloc;
+    size_t hsize, fsize;
+    uint32_t halloc, falloc;
 
-    hsize = block->block_size;
+    hsize = GET_SIZE(block);
     halloc = block->allocated;
     footer_t *footer = get_footer(block);
-    fsize = footer->block_size;
+    fsize = GET_SIZE(footer);
     falloc = footer->allocated;
 
     if (hsize == 0) {
@@ -574,7 +3163,7 @@ static void printblock(block_t *block) {
         return;
     }
 
-    printf("%p: header: [%d:%c] footer: [%d:%c]\n", block, hsize,
+    printf("%p: header: [%zu:%c] footer: [%zu:%c]\n", block, hsize,
            (halloc ? 'a' : 'f'), fsize, (falloc ? 'a' : 'f'));
 }
 
@@ -605,3 +3194,573 @@ static void checkblock(block_t *block) {
                 block, NEXT_BLKP(block));
     }
 }
+
+/*
+ * quick_pop - Take a block for asize off its quick list, counting a miss for the
+ *             maintenance thread to refill if the list is empty
+ */
+static void *quick_pop(size_t asize) {
+    int c = QUICK_LIST(asize);
+    void *payload = quick[c];
+    block_t *block;
+
+    if (payload == NULL) {
+        quick_miss[c]++;
+        return NULL;
+    }
+    quick[c] = *(void **)payload;
+    quick_count[c]--;
+    block = payload - sizeof(header_t);
+    block->tracked = 0;
+    block->movable = 0;
+    block->sampled = 0;
+    return payload;
+}
+
+/*
+ * quick_push - Cache the allocated main-heap block of payload on quick list c
+ */
+static void quick_push(void *payload, int c) {
+    *(void **)payload = quick[c];
+    quick[c] = payload;
+    quick_count[c]++;
+}
+
+/*
+ * drain_free_queue - Free every block queued by mm_free. Small main-heap blocks
+ *                    refill their quick list first, the rest go to mm_free_batch
+ *                    so neighbours are coalesced in one pass.
+ */
+/* $begin mmdrain */
+static void drain_free_queue(void) {
+    void *payload = atomic_exchange(&free_queue, NULL);
+    void *batch[DRAIN_BATCH];
+    size_t n = 0;
+
+    while (payload != NULL) {
+        void *next = *(void **)payload;
+        block_t *bp = payload - sizeof(header_t);
+        size_t size = GET_SIZE(bp);
+
+        if (bp->tracked) {
+            pred_untrack(payload);
+            bp->tracked = 0;
+        }
+        if (bp->sampled) {
+            prof_untrack(payload);
+            bp->sampled = 0;
+        }
+        if (bp->heap_id == 0 && size <= QUICK_MAX && quick_count[QUICK_LIST(size)] < QUICK_FILL) {
+            quick_push(payload, QUICK_LIST(size));
+        } else {
+            batch[n++] = payload;
+            if (n == DRAIN_BATCH) {
+                mm_free_batch(batch, n);
+                n = 0;
+            }
+        }
+        payload = next;
+    }
+    if (n > 0)
+        mm_free_batch(batch, n);
+}
+/* $end mmdrain */
+
+/*
+ * refill_quick - Top up the quick lists that missed since the last round, carving
+ *                each list's blocks out of a single free block
+ */
+static void refill_quick(void) {
+    for (int c = 0; c < QUICK_LISTS; c++) {
+        size_t asize = MIN_BLOCK_SIZE + c * DSIZE;
+        int n = QUICK_FILL - quick_count[c];
+        size_t align = slab_align(asize * n);
+        block_t *block;
+        size_t left;
+
+        if (quick_miss[c] == 0 || n <= 0)
+            continue;
+        quick_miss[c] = 0;
+        if (align) {
+            /* the batch starts on a multiple of its size, so no huge page splits it */
+            if ((block = find_or_extend(asize * n + align + MIN_BLOCK_SIZE)) == NULL)
+                return;
+            block = place_aligned(block, asize * n, align, sizeof(header_t));
+        } else {
+            if ((block = find_or_extend(asize * n)) == NULL)
+                return;
+            place(block, asize * n);
+        }
+
+        /* the last block keeps whatever place did not split off */
+        left = GET_SIZE(block);
+        for (int i = 0; i < n; i++) {
+            size_t size = (i == n - 1) ? left : asize;
+
+            PACK(HDRP(block), size, ALLOC);
+            PACK(FTRP(block), size, ALLOC);
+            block->heap_id = 0;
+            block->tracked = 0;
+            block->movable = 0;
+            block->sampled = 0;
+            quick_push(PLDP(block), c);
+            left -= size;
+            block = NEXT_BLKP(block);
+        }
+    }
+}
+
+/*
+ * flush_quick - Free every block cached on the quick lists
+ */
+static void flush_quick(void) {
+    void *batch[DRAIN_BATCH];
+    size_t n = 0;
+
+    for (int c = 0; c < QUICK_LISTS; c++) {
+        while (quick[c] != NULL) {
+            batch[n++] = quick[c];
+            quick[c] = *(void **)quick[c];
+            if (n == DRAIN_BATCH) {
+                mm_free_batch(batch, n);
+                n = 0;
+            }
+        }
+        quick_count[c] = 0;
+        quick_miss[c] = 0;
+    }
+    if (n > 0)
+        mm_free_batch(batch, n);
+}
+
+/*
+ * trim_wilderness - Give the pages of a large trailing free block back to the OS,
+ *                   once per block
+ */
+static void trim_wilderness(void) {
+    block_t *last = PREV_BLKP(epilogue);
+
+    if (!endFree() || GET_SIZE(last) < TRIM_MIN)
+        return;
+    if (last == trimmed && GET_SIZE(last) == trimmed_size)
+        return;
+    purge_block(last);
+    trimmed = last;
+    trimmed_size = GET_SIZE(last);
+}
+
+/*
+ * maint_main - Body of the maintenance thread
+ */
+static void *maint_main(void *arg) {
+    (void)arg;
+    while (!atomic_load(&maint_stop)) {
+        HEAP_LOCK();
+        drain_free_queue();
+        refill_quick();
+        trim_wilderness();
+        HEAP_UNLOCK();
+        usleep(MAINT_PERIOD_US);
+    }
+    return NULL;
+}
+
+/*
+ * block_ok - Whether the tags of block parse and it ends by end
+ */
+static bool block_ok(block_t *block, block_t *end) {
+    size_t size = GET_SIZE(block);
+    footer_t *ftr;
+
+    if (size < MIN_BLOCK_SIZE || size % DSIZE != 0 || (void *)block + size > (void *)end)
+        return false;
+    ftr = FTRP(block);
+    return GET_SIZE(ftr) == size && ftr->allocated == block->allocated;
+}
+
+/*
+ * pheap_recover - Rebuild the free lists of a heap file whose last process died
+ *                 inside an entry point. That call only rewrote the tags around
+ *                 one spot, so the blocks that parse from the front and from the
+ *                 back are kept and the gap between them is freed. Returns the
+ *                 size of the gap.
+ */
+/* $begin pheaprecover */
+static size_t pheap_recover(void) {
+    block_t *first = (void *)segList + MIN_BLOCK_SIZE * (LISTMAX + 1);
+    block_t *lo = first, *hi = epilogue, *prev = NULL, *bp, *run = NULL;
+    size_t gap;
+
+    PACK(epilogue, 0, ALLOC);
+    while (lo < hi && block_ok(lo, hi)) {
+        prev = lo;
+        lo = NEXT_BLKP(lo);
+    }
+    while (hi > lo) {
+        bp = (void *)hi - GET_SIZE(PREV_FTRP(hi));
+        if (bp < lo || bp >= hi || !block_ok(bp, hi))
+            break;
+        hi = bp;
+    }
+
+    gap = (void *)hi - (void *)lo;
+    if (gap >= MIN_BLOCK_SIZE) {
+        PACK(HDRP(lo), gap, FREE);
+        PACK(FTRP(lo), gap, FREE);
+    } else if (gap > 0 && prev != NULL) {
+        /* too small for a block of its own, the block in front takes it */
+        size_t size = GET_SIZE(prev) + gap;
+        PACK(HDRP(prev), size, GET_ALLOC(prev));
+        PACK(FTRP(prev), size, GET_ALLOC(prev));
+    } else if (gap > 0) {
+        /* nothing in front either: the heap ends here */
+        gap = (void *)epilogue - (void *)lo;
+        epilogue = lo;
+        PACK(epilogue, 0, ALLOC);
+        pheap->brk = (void *)epilogue + sizeof(header_t) - heap_base;
+    }
+
+    /* relink every free block, merging neighbours the crash left apart */
+    init_seglist(segList);
+    memset(fit_index, 0, sizeof(fit_index_t) * (LISTMAX + 1));
+    for (bp = first; ; bp = NEXT_BLKP(bp)) {
+        if (bp != epilogue && !GET_ALLOC(bp)) {
+            if (run == NULL)
+                run = bp;
+            continue;
+        }
+        if (run != NULL) {
+            size_t size = (void *)bp - (void *)run;
+            PACK(HDRP(run), size, FREE);
+            PACK(FTRP(run), size, FREE);
+            insertBlock(run);
+            run = NULL;
+        }
+        if (bp == epilogue)
+            break;
+    }
+    return gap;
+}
+/* $end pheaprecover */
+
+/*
+ * save_ctx, load_ctx - Park the globals of the active heap in ctx, or make the
+ *                      heap in ctx the active one
+ */
+static void save_ctx(heap_ctx_t *ctx) {
+    *ctx = (heap_ctx_t){ heap_base, pheap, pheap_fd, pheap_len, fit_index,
+                         prologue, segList, epilogue, clean_top };
+}
+
+static void load_ctx(const heap_ctx_t *ctx) {
+    heap_base = ctx->heap_base;
+    pheap = ctx->pheap;
+    pheap_fd = ctx->pheap_fd;
+    pheap_len = ctx->pheap_len;
+    fit_index = ctx->fit_index;
+    prologue = ctx->prologue;
+    segList = ctx->segList;
+    epilogue = ctx->epilogue;
+    clean_top = ctx->clean_top;
+}
+
+/*
+ * shm_enter - Swap shm in for this process's heap and take its lock. The heap
+ *             triple is reloaded since other processes move the epilogue, and
+ *             clean_top is pinned to the end: we do not know what they wrote.
+ *             If the last holder died with the lock its tags may be torn, so
+ *             the free lists are rebuilt as for a crashed heap file.
+ */
+/* $begin shmenter */
+static void shm_enter(mm_shm_t *shm) {
+    pheap_t *hdr = shm->ctx.pheap;
+    bool dead;
+
+    HEAP_LOCK();
+    save_ctx(&shm->own);
+    load_ctx(&shm->ctx);
+    dead = pthread_mutex_lock(&hdr->lock) == EOWNERDEAD;
+
+    prologue = heap_base + PHEAP_HDR;
+    segList = NEXT_BLKP(prologue);
+    epilogue = heap_base + hdr->brk - sizeof(header_t);
+    clean_top = heap_base + hdr->brk;
+    if (dead) {
+        pheap_recover();
+        pthread_mutex_consistent(&hdr->lock);
+    }
+}
+/* $end shmenter */
+
+/*
+ * shm_leave - Undo shm_enter
+ */
+static void shm_leave(mm_shm_t *shm) {
+    pthread_mutex_unlock(&shm->ctx.pheap->lock);
+    save_ctx(&shm->ctx);
+    load_ctx(&shm->own);
+    HEAP_UNLOCK();
+}
+
+/*
+ * prof_sample - Record the block of payload in the heap profile under the stack
+ *               that allocated it, and draw the next sampling interval. Not
+ *               inlined: PROF_SKIP counts its frame.
+ */
+/* $begin profsample */
+__attribute__((noinline))
+static void prof_sample(void *payload, size_t size) {
+    void *pc[PROF_DEPTH + PROF_SKIP];
+    uint64_t hash = 14695981039346656037ull;    /* FNV-1a over the frames */
+    prof_site_t *site = NULL;
+    uint32_t s = 0;
+    int depth;
+
+    prof_left = prof_interval();
+    if (prof_live_count >= PROF_LIVE / 4 * 3)
+        return;
+    depth = MAX(backtrace(pc, PROF_DEPTH + PROF_SKIP) - PROF_SKIP, 0);
+    for (int i = 0; i < depth; i++)
+        hash = (hash ^ (uintptr_t)pc[i + PROF_SKIP]) * 1099511628211ull;
+    hash |= 1;
+
+    /* find or claim the site, linear probing; a full table drops the sample */
+    for (int n = 0; n < PROF_SITES; n++) {
+        s = (hash + n) & (PROF_SITES - 1);
+        if (prof_sites[s].hash == hash || prof_sites[s].hash == 0) {
+            site = &prof_sites[s];
+            break;
+        }
+    }
+    if (site == NULL || !prof_insert(payload, s, size))
+        return;
+    if (site->hash == 0) {
+        site->hash = hash;
+        site->depth = depth;
+        memcpy(site->pc, pc + PROF_SKIP, depth * sizeof(void *));
+    }
+    site->live_count++;
+    site->live_bytes += size;
+    site->alloc_count++;
+    site->alloc_bytes += size;
+    ((block_t *)(payload - sizeof(header_t)))->sampled = 1;
+}
+/* $end profsample */
+
+/*
+ * prof_interval - Bytes to the next sample: exponential with mean prof_period.
+ *                 -ln(u) comes from a xorshift draw and a quadratic log2 of its
+ *                 mantissa, close enough for sampling and free of libm.
+ */
+static int64_t prof_interval(void) {
+    uint64_t r;
+    double m, log2u;
+    int e;
+
+    prof_rand ^= prof_rand << 13;
+    prof_rand ^= prof_rand >> 7;
+    prof_rand ^= prof_rand << 17;
+    r = (prof_rand >> 11) | 1;      /* u = r / 2^53 in (0, 1) */
+    e = 63 - __builtin_clzll(r);
+    m = (double)r / (double)(1ull << e) - 1;
+    log2u = (e - 53) + m * (1.3465 - 0.3465 * m);
+    return (int64_t)(-log2u * 0.6931471805599453 * prof_period) + 1;
+}
+
+/*
+ * prof_find - Slot of payload in prof_live, -1 if it is not there
+ */
+static int prof_find(void *payload) {
+    for (uint32_t i = PROF_HASH(payload); prof_live[i].payload != NULL; i = (i + 1) & (PROF_LIVE - 1))
+        if (prof_live[i].payload == payload)
+            return i;
+    return -1;
+}
+
+/*
+ * prof_insert - Add payload to prof_live
+ */
+static bool prof_insert(void *payload, uint32_t site, size_t size) {
+    uint32_t i = PROF_HASH(payload);
+
+    if (prof_live_count >= PROF_LIVE / 4 * 3)
+        return false;
+    while (prof_live[i].payload != NULL)
+        i = (i + 1) & (PROF_LIVE - 1);
+    prof_live[i].payload = payload;
+    prof_live[i].site = site;
+    prof_live[i].size = size;
+    prof_live_count++;
+    return true;
+}
+
+/*
+ * prof_remove - Empty slot i of prof_live, shifting back the entries of its
+ *               probe run so that no lookup stops early at the hole
+ */
+static void prof_remove(uint32_t i) {
+    uint32_t j = i;
+
+    prof_live[i].payload = NULL;
+    prof_live_count--;
+    for (;;) {
+        j = (j + 1) & (PROF_LIVE - 1);
+        if (prof_live[j].payload == NULL)
+            return;
+        uint32_t home = PROF_HASH(prof_live[j].payload);
+        /* j can fill the hole unless its home lies cyclically in (i, j] */
+        if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) {
+            prof_live[i] = prof_live[j];
+            prof_live[j].payload = NULL;
+            i = j;
+        }
+    }
+}
+
+/*
+ * prof_untrack - Take the freed sampled block of payload out of the live profile
+ */
+static void prof_untrack(void *payload) {
+    int i = prof_find(payload);
+
+    if (i < 0)
+        return;
+    prof_sites[prof_live[i].site].live_count--;
+    prof_sites[prof_live[i].site].live_bytes -= prof_live[i].size;
+    prof_remove(i);
+}
+
+/*
+ * prof_move - Rekey a sampled block that mm_compact moved from one payload to another
+ */
+static void prof_move(void *from, void *to) {
+    int i = prof_find(from);
+    uint32_t site;
+    size_t size;
+
+    if (i < 0)
+        return;
+    site = prof_live[i].site;
+    size = prof_live[i].size;
+    prof_remove(i);
+    prof_insert(to, site, size);
+}
+
+/*
+ * lat_bucket - Histogram bucket of ticks: below LAT_SUB one per value, above it
+ *              LAT_SUB per power of two
+ */
+static int lat_bucket(uint64_t ticks) {
+    int e;
+
+    if (ticks < LAT_SUB)
+        return ticks;
+    e = 63 - __builtin_clzll(ticks);
+    return ((e - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + ((ticks >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/*
+ * lat_bucket_top - Largest tick count that falls into bucket i
+ */
+static uint64_t lat_bucket_top(int i) {
+    int e;
+
+    if (i < LAT_SUB)
+        return i;
+    e = (i >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    return (((uint64_t)(LAT_SUB + (i & (LAT_SUB - 1))) + 1) << (e - LAT_SUB_BITS)) - 1;
+}
+
+/*
+ * lat_record - Count one timed run of op that took ticks
+ */
+static void lat_record(int op, uint64_t ticks) {
+    uint64_t max = atomic_load_explicit(&lat_max[op], memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&lat_hist[op][lat_bucket(ticks)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&lat_count[op], 1, memory_order_relaxed);
+    while (ticks > max && !atomic_compare_exchange_weak(&lat_max[op], &max, ticks))
+        ;
+}
+
+/*
+ * grow_in_place - Grow allocated block to asize bytes out of the free block behind
+ *                 it, extending the main heap when the block is its last one.
+ *                 Returns false, with nothing changed, if it cannot.
+ */
+static bool grow_in_place(block_t *block, size_t asize) {
+    size_t size = GET_SIZE(block);
+    block_t *next = (void *)NEXT_BLKP(block);
+    size_t avail = GET_ALLOC(next) ? 0 : GET_SIZE(next);
+    block_t *last = avail ? (void *)NEXT_BLKP(next) : next;
+
+    if (size + avail < asize) {
+        if (cur_heap != &main_heap || GET_SIZE(last) != 0)
+            return false;
+        /* the new space merges with a free next block in extend_heap */
+        if ((next = extend_heap(MAX(asize - size - avail, MIN_BLOCK_SIZE) >> 3)) == NULL)
+            return false;
+        avail = GET_SIZE(next);
+    }
+    removeBlock(next);
+    size += avail;
+
+    /* split off the rest as place does; what follows it is allocated */
+    if (size - asize > 1289) {
+        block_t *rest;
+
+        PACK(HDRP(block), asize, ALLOC);
+        PACK(FTRP(block), asize, ALLOC);
+        rest = (void *)NEXT_BLKP(block);
+        PACK(HDRP(rest), size - asize, FREE);
+        PACK(FTRP(rest), size - asize, FREE);
+        insertBlock(rest);
+    } else {
+        PACK(HDRP(block), size, ALLOC);
+        PACK(FTRP(block), size, ALLOC);
+    }
+    if (NEXT_BLKP(block) > clean_top)
+        clean_top = NEXT_BLKP(block);
+    return true;
+}
+
+/*
+ * shrink_block - Cut allocated block down to asize bytes, at least MIN_BLOCK_SIZE
+ *                less than it has, and free the tail
+ */
+static void shrink_block(block_t *block, size_t asize) {
+    size_t size = GET_SIZE(block);
+    block_t *rest;
+
+    PACK(HDRP(block), asize, ALLOC);
+    PACK(FTRP(block), asize, ALLOC);
+    rest = (void *)NEXT_BLKP(block);
+    PACK(HDRP(rest), size - asize, FREE);
+    PACK(FTRP(rest), size - asize, FREE);
+    coalesce(rest);
+}
+
+/*
+ * grow_track - Remember that payload has grown growths times, to size bytes
+ */
+static void grow_track(void *payload, uint32_t growths, size_t size) {
+    grow_t *g = GROW_SLOT(payload);
+
+    if (g->payload == NULL)
+        grow_live++;
+    g->payload = payload;
+    g->growths = growths;
+    g->size = size;
+}
+
+/*
+ * grow_forget - Drop the growth record of payload, which is being freed
+ */
+static void grow_forget(void *payload) {
+    grow_t *g = GROW_SLOT(payload);
+
+    if (g->payload == payload) {
+        g->payload = NULL;
+        grow_live--;
+    }
+}
@@ -0,0 +1,144 @@
+/*
+ * mm.hpp - STL allocator and per-type object pool on top of mm.c
+ *
+ * mm::allocator<T> can be dropped into any standard container. Single-object
+ * requests for types whose block is at most pool_max bytes are served by
+ * mm::pool<T>, a free list dedicated to T chosen at compile time, so the node
+ * churn of std::map and std::list never reaches calcList or find_fit. Larger
+ * types go to mm_malloc, as a pool never gives its slots back to the heap.
+ * Like mm.c itself none of this is thread-safe, and pools must be released
+ * before mm_init throws the heap away.
+ */
+#ifndef MM_HPP
+#define MM_HPP
+
+#include <cstddef>
+#include <limits>
+#include <new>
+
+extern "C" {
+#include "mm.h"
+}
+#include "mm_ext.h"
+
+namespace mm {
+
+/* Block size mm_malloc uses for a request of size bytes */
+constexpr std::size_t block_size(std::size_t size) {
+    return ((size + MM_OVERHEAD + 7) / 8 * 8 < MM_MIN_BLOCK) ? MM_MIN_BLOCK
+                                                               : (size + MM_OVERHEAD + 7) / 8 * 8;
+}
+
+/* Largest block a pool serves, the quick-list cap of mm.c */
+constexpr std::size_t pool_max = 256;
+
+/*
+ * pool - Free list of T-sized slots. Slots are carved from chunks of about a
+ *        page obtained with mm_malloc and are recycled by type, never freed
+ *        one by one; release() hands the chunks back once no T is alive.
+ */
+template <class T>
+class pool {
+public:
+    static T *allocate() {
+        if (free_ == nullptr && !refill())
+            throw std::bad_alloc();
+        slot *s = free_;
+        free_ = s->next;
+        return reinterpret_cast<T *>(s);
+    }
+
+    static void deallocate(T *p) noexcept {
+        slot *s = reinterpret_cast<slot *>(p);
+        s->next = free_;
+        free_ = s;
+    }
+
+    static void release() noexcept {
+        while (chunks_ != nullptr) {
+            chunk *next = chunks_->next;
+            mm_free(chunks_);
+            chunks_ = next;
+        }
+        free_ = nullptr;
+    }
+
+private:
+    union slot {
+        slot *next;
+        alignas(T) unsigned char bytes[sizeof(T)];
+    };
+    struct chunk {
+        chunk *next;
+    };
+
+    static constexpr std::size_t per_chunk = (sizeof(slot) < 4096 / 8) ? 4096 / sizeof(slot) : 8;
+    static constexpr std::size_t slots_at = (sizeof(chunk) + alignof(slot) - 1) / alignof(slot) * alignof(slot);
+
+    static bool refill() {
+        chunk *c = static_cast<chunk *>(mm_malloc(slots_at + per_chunk * sizeof(slot)));
+        if (c == nullptr)
+            return false;
+        c->next = chunks_;
+        chunks_ = c;
+
+        slot *s = reinterpret_cast<slot *>(reinterpret_cast<unsigned char *>(c) + slots_at);
+        for (std::size_t i = 0; i < per_chunk; i++) {
+            s[i].next = free_;
+            free_ = &s[i];
+        }
+        return true;
+    }
+
+    static inline slot *free_ = nullptr;
+    static inline chunk *chunks_ = nullptr;
+};
+
+/*
+ * allocator - std::allocator replacement backed by mm_malloc/mm_free
+ */
+template <class T>
+struct allocator {
+    using value_type = T;
+
+    /* single objects of small types go to their pool */
+    static constexpr bool pooled = block_size(sizeof(T)) <= pool_max && alignof(T) <= 8;
+
+    allocator() noexcept = default;
+    template <class U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        if constexpr (pooled) {
+            if (n == 1)
+                return pool<T>::allocate();
+        }
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+
+        void *p = (alignof(T) > 8) ? mm_memalign(alignof(T), n * sizeof(T)) : mm_malloc(n * sizeof(T));
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        if constexpr (pooled) {
+            if (n == 1) {
+                pool<T>::deallocate(p);
+                return;
+            }
+        }
+        mm_free(p);
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept { return true; }
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept { return false; }
+
+} // namespace mm
+
+#endif /* MM_HPP */
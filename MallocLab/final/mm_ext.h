@@ -0,0 +1,192 @@
+/*
+ * mm_ext.h - Extensions to the mm.h allocator interface
+ */
+#ifndef MM_EXT_H
+#define MM_EXT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MM_CACHELINE 64     /* cache line size assumed by mm_malloc_cacheline */
+
+/* Seglist geometry of mm.c, mirrored at compile time by mm.hpp */
+#define MM_LISTMAX 5        /* seglists 0..MM_LISTMAX */
+#define MM_MINSIZE 3998     /* largest block of seglist 0, each list is 1.67x the last */
+#define MM_OVERHEAD 16      /* header + footer of an allocated block */
+#define MM_MIN_BLOCK 32
+
+/* Aligned allocation; alignment must be a power of two */
+void *mm_memalign(size_t alignment, size_t size);
+void *mm_aligned_alloc(size_t alignment, size_t size);
+void *mm_malloc_cacheline(size_t size);
+
+/* Rotate the cache-line offset of large payloads; off by default */
+int mm_set_cache_coloring(int enable);
+
+/* Grow the heap in 2 MiB steps backed by transparent huge pages; off by default */
+int mm_set_huge_pages(int enable);
+
+/* Give back the headroom mm_realloc adds to blocks that keep growing */
+size_t mm_realloc_reclaim(void);
+
+/* Memory pressure. Callbacks free bytes of the caller's caches (0: all they can
+ * spare) when the heap cannot grow and when mm_release_free_memory runs short;
+ * they run with the heap locked, may call mm_free but not (un)register.
+ * mm_release_free_memory flushes the allocator's caches, coalesces and purges
+ * free pages until target_bytes of resident memory are back with the OS. */
+typedef void (*mm_pressure_fn)(size_t bytes, void *arg);
+
+typedef struct {
+    size_t target;
+    size_t released;        /* resident bytes given back to the OS */
+    int stages;             /* how far it had to go, see mm_release_free_memory */
+    unsigned long long ns;  /* time it took */
+} mm_release_t;
+
+int mm_register_pressure_callback(mm_pressure_fn fn, void *arg);
+int mm_unregister_pressure_callback(mm_pressure_fn fn, void *arg);
+size_t mm_release_free_memory(size_t target_bytes, mm_release_t *report);
+
+/* Zeroed allocation; skips the memset for never-used heap space */
+void *mm_calloc(size_t nmemb, size_t size);
+
+/* Batch and epoch-deferred frees. Readers bracket lock-free accesses with
+ * mm_epoch_enter/exit from any thread; everything else is allocator-thread only. */
+void mm_free_batch(void **ptrs, size_t n);
+void mm_free_deferred(void *ptr);
+int mm_epoch_enter(void);
+void mm_epoch_exit(void);
+size_t mm_epoch_reclaim(void);
+
+/* Background maintenance thread: while it runs, mm_free just queues the block and
+ * the thread coalesces, trims and refills per-size quick lists for mm_malloc.
+ * Entry points serialize on one lock then, so they may be called from any thread. */
+int mm_maint_start(void);
+void mm_maint_stop(void);
+
+/* Persistent heap in a memory-mapped file, reattached in O(1) after a restart.
+ * mm_init_from_file replaces the memlib heap; sub-heaps and handles are refused
+ * while it is in use. The root object is how a restarted process finds its data. */
+int mm_init_from_file(const char *path, size_t max_size);
+int mm_file_check(void);
+int mm_file_sync(void);
+void mm_file_close(void);
+void *mm_file_root(void);
+void mm_file_set_root(void *ptr);
+
+/* Heap in POSIX shared memory, mapped by several processes at once. A block is
+ * passed between them as its mm_shm_offset and may be freed by any of them. */
+typedef struct mm_shm mm_shm_t;
+
+mm_shm_t *mm_shm_create(const char *name, size_t size);
+mm_shm_t *mm_shm_attach(const char *name);
+void *mm_shm_malloc(mm_shm_t *shm, size_t size);
+void mm_shm_free(mm_shm_t *shm, void *ptr);
+size_t mm_shm_offset(mm_shm_t *shm, void *ptr);
+void *mm_shm_ptr(mm_shm_t *shm, size_t offset);
+void mm_shm_detach(mm_shm_t *shm);
+int mm_shm_unlink(const char *name);
+
+/* Sampling heap profiler: about one allocation per sample_bytes is attributed
+ * to its call stack until freed; mm_profile_dump writes a pprof heap profile */
+void mm_profile_start(size_t sample_bytes);
+void mm_profile_stop(void);
+int mm_profile_dump(const char *path);
+
+/* Heap map: mm_heap_map appends a snapshot of the main heap to path, for
+ * bench/heapmap to render. A snapshot is an mm_map_header_t, then one word per
+ * block in address order holding its size, seglist class and state. */
+#define MM_MAP_MAGIC 0x50414d48u  /* "HMAP" */
+#define MM_MAP_VERSION 1
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long seq;         /* snapshot number within the process */
+    unsigned long long first;       /* offset of the first block from the heap start */
+    unsigned long long heap_size;
+    unsigned long long blocks;      /* words that follow */
+} mm_map_header_t;
+
+#define MM_MAP_SIZE(w)  ((w) & ((1ull << 52) - 1))
+#define MM_MAP_CLASS(w) ((int)((w) >> 56 & 15))
+#define MM_MAP_STATE(w) ((int)((w) >> 60 & 3))
+
+enum mm_map_state {
+    MM_MAP_FREE,
+    MM_MAP_ALLOC,
+    MM_MAP_MOVABLE          /* allocated behind a handle, see mm_halloc */
+};
+
+int mm_heap_map(const char *path);
+
+/* Latency histograms of the entry points and of the paths inside them, in TSC
+ * ticks (ns without a TSC). Percentiles are exact to 1/8 of their value;
+ * mm_latency_report prints them all to stderr. */
+enum mm_latency_op {
+    MM_LAT_MALLOC,
+    MM_LAT_FREE,
+    MM_LAT_REALLOC,
+    MM_LAT_FIT,             /* find_fit that found a block */
+    MM_LAT_EXTEND,          /* fit search that failed plus growing the heap */
+    MM_LAT_SPLIT,           /* place that split the block */
+    MM_LAT_COALESCE_ATA,    /* coalesce with neither neighbour free */
+    MM_LAT_COALESCE_FTA,    /* ... with the previous block free */
+    MM_LAT_COALESCE_ATF,    /* ... with the next block free */
+    MM_LAT_COALESCE_FTF,    /* ... with both free */
+    MM_LAT_REALLOC_COPY,    /* the memcpy of mm_realloc */
+    MM_LAT_OPS
+};
+
+int mm_latency_enable(int enable);
+void mm_latency_reset(void);
+size_t mm_latency_count(int op);
+unsigned long long mm_latency_percentile(int op, double pct);
+double mm_latency_tick_ns(void);
+void mm_latency_report(void);
+
+/* Lifetime classes for mm_malloc_hint; each non-default class has its own sub-heap */
+enum mm_lifetime {
+    MM_LIFETIME_DEFAULT,    /* main heap */
+    MM_LIFETIME_SHORT,      /* request-scoped objects */
+    MM_LIFETIME_LONG,       /* caches and other long-lived state */
+    MM_LIFETIME_AUTO        /* predicted from call site and size */
+};
+
+void *mm_malloc_hint(size_t size, int lifetime);
+
+/* Independent heaps; mm_free also works on their blocks */
+typedef struct mm_heap mm_heap_t;
+
+mm_heap_t *mm_heap_create(void);
+void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+void mm_heap_free(mm_heap_t *heap, void *ptr);
+void mm_heap_destroy(mm_heap_t *heap);
+
+/* Movable blocks behind handles, compacted by mm_compact */
+typedef unsigned long mm_handle_t;
+
+#define MM_HANDLE_NULL 0
+
+mm_handle_t mm_halloc(size_t size);
+void *mm_hlock(mm_handle_t h);
+void mm_hunlock(mm_handle_t h);
+void mm_hfree(mm_handle_t h);
+size_t mm_compact(size_t max_bytes);
+
+/* Arenas: bump allocation, objects are only freed all at once */
+typedef struct mm_arena mm_arena_t;
+
+mm_arena_t *mm_arena_create(size_t chunk_size);
+void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+void mm_arena_reset(mm_arena_t *arena);
+void mm_arena_destroy(mm_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MM_EXT_H */
@@ -0,0 +1,468 @@
+/*
+ * regress.c - Regression cases for the final allocator, one per bug that got past
+ *             review once
+ *
+ * Build against the handout's memlib:
+ *     gcc -O2 -I../final -o regress regress.c ../final/mm.c memlib.c -pthread
+ *
+ * Usage: regress [-l] [case...]
+ *
+ * Every case runs in its own child on a fresh heap, so a crash is reported
+ * rather than ending the run, and ends with mm_checkheap. The allocator only
+ * prints when something is wrong, so anything it prints fails the case and goes
+ * to stderr. Prints one tab-separated line per case and exits 1 if any failed.
+ *
+ * Cases marked large need blocks past 4 GiB and only run with -l. They want a
+ * memlib whose heap reaches 8 GiB; the pages they touch stay in the megabytes,
+ * so set MAX_HEAP in config.h to (8ull << 30) and have mem_init mmap the heap
+ * with MAP_NORESERVE instead of mallocing it; see README.
+ * failed_growth runs either way but only reaches memlib's limit part way
+ * through a request with -l.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+#include "mm_ext.h"
+
+#define GiB (1ull << 30)
+
+void mm_checkheap(int verbose);
+
+typedef struct {
+    const char *name;
+    int large;              /* needs -l */
+    int (*run)(void);       /* returns -1 on a wrong result */
+} case_t;
+
+static FILE *said;          /* the child's stdout, where the allocator complains */
+
+/*
+ * heap_ok - Whether mm_checkheap and everything before it in the case kept quiet
+ */
+static int heap_ok(void) {
+    mm_checkheap(0);
+    fflush(stdout);
+    return lseek(fileno(said), 0, SEEK_END) == 0;
+}
+
+/* Stamp the word at each offset of p, or check that the stamps are still there */
+static void stamp(char *p, const size_t *off, int n) {
+    for (int i = 0; i < n; i++)
+        memcpy(p + off[i], &off[i], sizeof(size_t));
+}
+
+static int stamped(const char *p, const size_t *off, int n) {
+    for (int i = 0; i < n; i++)
+        if (memcmp(p + off[i], &off[i], sizeof(size_t)) != 0)
+            return 0;
+    return 1;
+}
+
+/* Zeroing elision: a block freed next to heap space that was never handed out
+ * merges with it, alone (ATF) or with a free block in front (FTF), and
+ * mm_calloc over the merged space reads zero. mm_memalign leaves such space
+ * behind its block and a free block for the padding in front, which a plain
+ * mm_malloc fills for ATF. */
+static int coalesce_clean(int ftf) {
+    char *x, *a, *pad = NULL, *p;
+
+    if ((x = mm_malloc(3000)) == NULL || (a = mm_memalign(4096, 100)) == NULL)
+        return -1;
+    memset(x, 0xa5, 3000);
+    memset(a, 0x5a, 100);
+    if (!ftf && (pad = mm_malloc(800)) == NULL)
+        return -1;
+    mm_free(a);
+    if (!heap_ok() || (p = mm_calloc(1, 20000)) == NULL)
+        return -1;
+    for (int i = 0; i < 20000; i++)
+        if (p[i] != 0)
+            return -1;
+    mm_free(p);
+    if (pad != NULL)
+        mm_free(pad);
+    mm_free(x);
+    return 0;
+}
+
+static int case_coalesce_atf(void) {
+    return coalesce_clean(0);
+}
+
+static int case_coalesce_ftf(void) {
+    return coalesce_clean(1);
+}
+
+/* A 5 GiB block keeps the bytes around the 2 and 4 GiB marks apart, and is freed
+ * into a free block that the next large request reuses */
+static int case_large_malloc(void) {
+    size_t size = 5 * GiB;
+    size_t off[] = {0, 2 * GiB - 8, 2 * GiB, 4 * GiB - 8, 4 * GiB, size - 8};
+    char *p, *q, *small;
+
+    if ((p = mm_malloc(size)) == NULL)
+        return -1;
+    stamp(p, off, 6);
+    if ((small = mm_malloc(100)) == NULL || !stamped(p, off, 6) || !heap_ok())
+        return -1;
+    mm_free(p);
+    if (!heap_ok() || (q = mm_malloc(4 * GiB + 4096)) != p)
+        return -1;
+    mm_free(q);
+    mm_free(small);
+    return 0;
+}
+
+/* Growing a small block past 4 GiB and cutting it back keeps its data */
+static int case_large_realloc(void) {
+    size_t off[] = {16, 4 * GiB - 8, 4 * GiB, 5 * GiB - 8};
+    char *p;
+
+    if ((p = mm_malloc(100)) == NULL)
+        return -1;
+    memcpy(p, "large_realloc", 14);
+    if ((p = mm_realloc(p, 5 * GiB)) == NULL || memcmp(p, "large_realloc", 14) != 0 || !heap_ok())
+        return -1;
+    stamp(p, off, 4);
+    if ((p = mm_realloc(p, 4096)) == NULL || memcmp(p, "large_realloc", 14) != 0)
+        return -1;
+    if (!stamped(p, off, 1) || !heap_ok())
+        return -1;
+    mm_free(p);
+    return heap_ok() ? 0 : -1;
+}
+
+/* Growing a block past 4 GiB in place and cutting it back keeps its data */
+static int case_large_realloc_grow(void) {
+    size_t off[] = {0, 4 * GiB - 8, 4 * GiB, 5 * GiB - 8};
+    char *p;
+
+    if ((p = mm_malloc(5 * GiB)) == NULL)
+        return -1;
+    stamp(p, off, 4);
+    if ((p = mm_realloc(p, 6 * GiB)) == NULL || !stamped(p, off, 4) || !heap_ok())
+        return -1;
+    memset(p + 6 * GiB - 4096, 1, 4096);
+    if ((p = mm_realloc(p, 5 * GiB)) == NULL || !stamped(p, off, 4) || !heap_ok())
+        return -1;
+    mm_free(p);
+    return heap_ok() ? 0 : -1;
+}
+
+/* mm_calloc past 4 GiB on heap space never used reads as zero */
+static int case_large_calloc(void) {
+    size_t off[] = {0, 4 * GiB - 8, 4 * GiB, 9 * (GiB / 2) - 8};
+    char *p;
+
+    if ((p = mm_calloc(9, GiB / 2)) == NULL)
+        return -1;
+    for (int i = 0; i < 4; i++)
+        if (*(size_t *)(p + off[i]) != 0)
+            return -1;
+    mm_free(p);
+    return heap_ok() ? 0 : -1;
+}
+
+/* A request memlib cannot cover fails cleanly, even when it runs out after some
+ * of the int-sized mem_sbrk steps a large one takes have moved the brk */
+static int case_failed_growth(void) {
+    void *p;
+
+    if (mm_malloc(1ull << 40) != NULL || !heap_ok())
+        return -1;
+    for (int i = 0; i < 4; i++) {
+        if ((p = mm_malloc(1 << 16)) == NULL)
+            return -1;
+        memset(p, 1, 1 << 16);
+    }
+    mm_free(p);
+    return heap_ok() ? 0 : -1;
+}
+
+/* Grow a block through mm_realloc until it has headroom for mm_realloc_reclaim
+ * to take back */
+static char *grown(char *p) {
+    for (size_t size = 2000; p != NULL && size <= 16000; size *= 2)
+        p = mm_realloc(p, size);
+    return p;
+}
+
+/* mm_heap_destroy takes the sub-heap's sampled blocks out of the heap profile */
+static int case_profile_destroy(void) {
+    char path[] = "/tmp/mm_regress_XXXXXX";
+    unsigned long objs = 1, bytes = 1;
+    mm_heap_t *heap;
+    FILE *f;
+    int fd;
+
+    if ((heap = mm_heap_create()) == NULL || (fd = mkstemp(path)) < 0)
+        return -1;
+    close(fd);
+    mm_profile_start(1);
+    for (int i = 0; i < 100; i++)
+        if (mm_heap_malloc(heap, 500) == NULL)
+            return -1;
+    mm_heap_destroy(heap);
+    mm_profile_stop();
+    if (mm_profile_dump(path) < 0 || (f = fopen(path, "r")) == NULL)
+        return -1;
+    if (fscanf(f, "heap profile: %lu: %lu", &objs, &bytes) != 2)
+        objs = 1;
+    fclose(f);
+    unlink(path);
+    return (objs == 0 && bytes == 0 && heap_ok()) ? 0 : -1;
+}
+
+/* mm_init forgets the blocks mm_realloc grew in the heap it throws away: their
+ * addresses come back in the new heap holding someone else's data */
+static int case_reclaim_reinit(void) {
+    char *p;
+
+    if ((p = grown(mm_malloc(1000))) == NULL)
+        return -1;
+    mem_reset_brk();
+    if (mm_init() < 0 || (p = mm_malloc(64000)) == NULL)
+        return -1;
+    memset(p, 0xff, 64000);
+    mm_realloc_reclaim();
+    for (int i = 0; i < 64000; i++)
+        if ((unsigned char)p[i] != 0xff)
+            return -1;
+    mm_free(p);
+    return heap_ok() ? 0 : -1;
+}
+
+/* mm_heap_destroy forgets the blocks mm_realloc grew in the sub-heap, whose
+ * extents go back to the main heap and get handed out again */
+static int case_reclaim_destroy(void) {
+    mm_heap_t *heap;
+    char *p;
+
+    if ((heap = mm_heap_create()) == NULL || (p = mm_heap_malloc(heap, 1000)) == NULL)
+        return -1;
+    if (grown(p) == NULL)
+        return -1;
+    mm_heap_destroy(heap);
+    if ((p = mm_malloc(64000)) == NULL)
+        return -1;
+    memset(p, 0xff, 64000);
+    mm_realloc_reclaim();
+    for (int i = 0; i < 64000; i++)
+        if ((unsigned char)p[i] != 0xff)
+            return -1;
+    mm_free(p);
+    return heap_ok() ? 0 : -1;
+}
+
+/* mm_release_free_memory goes through every stage, mm_realloc_reclaim included,
+ * over a heap that was thrown away or lost a sub-heap; p must keep its data */
+static int released_ok(char *p, size_t size) {
+    mm_release_t report;
+
+    memset(p, 0xff, size);
+    mm_release_free_memory(0, &report);
+    if (report.stages != 3)
+        return 0;
+    for (size_t i = 0; i < size; i++)
+        if ((unsigned char)p[i] != 0xff)
+            return 0;
+    return heap_ok();
+}
+
+static int case_release_reinit(void) {
+    char *p;
+
+    if ((p = grown(mm_malloc(1000))) == NULL)
+        return -1;
+    mem_reset_brk();
+    if (mm_init() < 0 || (p = mm_malloc(64000)) == NULL || !released_ok(p, 64000))
+        return -1;
+    mm_free(p);
+    return 0;
+}
+
+static int case_release_destroy(void) {
+    mm_heap_t *heap;
+    char *p, *q;
+
+    if ((p = mm_malloc(100000)) == NULL || (heap = mm_heap_create()) == NULL)
+        return -1;
+    if ((q = mm_heap_malloc(heap, 1000)) == NULL || grown(q) == NULL)
+        return -1;
+    mm_free(p);
+    mm_heap_destroy(heap);
+    if ((p = mm_malloc(64000)) == NULL || !released_ok(p, 64000))
+        return -1;
+    mm_free(p);
+    return 0;
+}
+
+/* Main-heap blocks a pressure callback holds on to, and frees when asked */
+static void *held[64];
+
+static void free_held(size_t bytes, void *arg) {
+    (void)bytes, (void)arg;
+    for (int i = 0; i < 64; i++) {
+        if (held[i] != NULL)
+            mm_free(held[i]);
+        held[i] = NULL;
+    }
+}
+
+/* A shared heap that runs out fails the request: the pressure callbacks free
+ * blocks of the process's own heap, which must not land on its free lists */
+static int case_shm_pressure(void) {
+    size_t size = 1 << 20;
+    char name[64];
+    mm_shm_t *shm;
+    void *p;
+    int bad = 0;
+
+    for (int i = 0; i < 64; i++)
+        if ((held[i] = mm_malloc(4096)) == NULL)
+            return -1;
+    snprintf(name, sizeof(name), "/mm_regress_%d", (int)getpid());
+    if ((shm = mm_shm_create(name, size)) == NULL)
+        return -1;
+    mm_register_pressure_callback(free_held, NULL);
+    while ((p = mm_shm_malloc(shm, 4096)) != NULL)
+        bad |= mm_shm_offset(shm, p) >= size;
+    mm_unregister_pressure_callback(free_held, NULL);
+    mm_shm_detach(shm);
+    mm_shm_unlink(name);
+    free_held(0, NULL);
+    return (bad || !heap_ok()) ? -1 : 0;
+}
+
+/* mm_memalign turns away what no block can hold instead of wrapping the size it
+ * looks for around to a small one */
+static int case_memalign_oversize(void) {
+    if (mm_memalign(64, SIZE_MAX) != NULL || mm_memalign(4096, SIZE_MAX - 100000) != NULL)
+        return -1;
+    if (mm_memalign((size_t)1 << 63, 100) != NULL)
+        return -1;
+    return heap_ok() ? 0 : -1;
+}
+
+/* Neither does mm_malloc with cache coloring, which pads large blocks too */
+static int case_color_oversize(void) {
+    mm_set_cache_coloring(1);
+    if (mm_malloc(SIZE_MAX) != NULL || mm_malloc(SIZE_MAX - 100000) != NULL)
+        return -1;
+    return heap_ok() ? 0 : -1;
+}
+
+/* mm_realloc of a block with headroom turns away sizes no block can hold, and
+ * one the heap cannot grow to, leaving the block as it was */
+static int case_realloc_oversize(void) {
+    char *p, *q;
+
+    if ((p = grown(mm_malloc(1000))) == NULL)
+        return -1;
+    memset(p, 0x5a, 16000);
+    if (mm_realloc(p, SIZE_MAX - 64) != NULL || mm_realloc(p, 1ull << 40) != NULL)
+        return -1;
+    mm_realloc_reclaim();
+    if ((q = mm_realloc(p, 20000)) == NULL)
+        return -1;
+    for (int i = 0; i < 16000; i++)
+        if (q[i] != 0x5a)
+            return -1;
+    mm_free(q);
+    return heap_ok() ? 0 : -1;
+}
+
+static const case_t cases[] = {
+    {"coalesce_atf", 0, case_coalesce_atf},
+    {"coalesce_ftf", 0, case_coalesce_ftf},
+    {"failed_growth", 0, case_failed_growth},
+    {"reclaim_reinit", 0, case_reclaim_reinit},
+    {"reclaim_destroy", 0, case_reclaim_destroy},
+    {"profile_destroy", 0, case_profile_destroy},
+    {"release_reinit", 0, case_release_reinit},
+    {"release_destroy", 0, case_release_destroy},
+    {"shm_pressure", 0, case_shm_pressure},
+    {"memalign_oversize", 0, case_memalign_oversize},
+    {"color_oversize", 0, case_color_oversize},
+    {"realloc_oversize", 0, case_realloc_oversize},
+    {"large_malloc", 1, case_large_malloc},
+    {"large_realloc", 1, case_large_realloc},
+    {"large_realloc_grow", 1, case_large_realloc_grow},
+    {"large_calloc", 1, case_large_calloc},
+};
+
+/*
+ * run_case - Run c in a child on a fresh heap; returns its result line
+ */
+static const char *run_case(const case_t *c) {
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    if ((pid = fork()) < 0)
+        return "fork failed";
+    if (pid == 0) {
+        int bad;
+        char line[256];
+
+        if ((said = tmpfile()) == NULL)
+            _exit(2);
+        dup2(fileno(said), STDOUT_FILENO);
+        mem_reset_brk();
+        if (mm_init() < 0)
+            _exit(2);
+        bad = c->run() < 0;
+        bad |= !heap_ok();
+
+        /* pass on what the allocator said */
+        rewind(said);
+        while (fgets(line, sizeof(line), said) != NULL)
+            fprintf(stderr, "%s: %s", c->name, line);
+        _exit(bad);
+    }
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status))
+        return "crashed";
+    if (WEXITSTATUS(status) == 2)
+        return "no heap";
+    return WEXITSTATUS(status) ? "FAILED" : "ok";
+}
+
+int main(int argc, char **argv) {
+    int large = 0, failed = 0, c;
+
+    while ((c = getopt(argc, argv, "l")) != -1) {
+        if (c != 'l') {
+            fprintf(stderr, "usage: %s [-l] [case...]\n", argv[0]);
+            return 2;
+        }
+        large = 1;
+    }
+    mem_init();
+
+    printf("case\tresult\n");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const case_t *t = &cases[i];
+        int wanted = (optind == argc);
+        const char *result;
+
+        for (int a = optind; a < argc; a++)
+            wanted |= !strcmp(argv[a], t->name);
+        if (!wanted)
+            continue;
+        if (t->large && !large) {
+            printf("%s\tskipped, needs -l\n", t->name);
+            continue;
+        }
+        result = run_case(t);
+        failed |= strcmp(result, "ok") != 0;
+        printf("%s\t%s\n", t->name, result);
+    }
+    return failed;
+}